@@ -300,6 +300,28 @@ do {									\
 #define irqsafe_cpu_xor_2(pcp, val)	percpu_to_op("xor", (pcp), val)
 #define irqsafe_cpu_xor_4(pcp, val)	percpu_to_op("xor", (pcp), val)
 
+#ifdef CONFIG_X86_32
+/*
+ * cmpxchg8b of two adjacent per cpu words. The instruction is missing
+ * on 386 class processors, which use the generic irq disabling version.
+ */
+#define percpu_cmpxchg8b_double(pcp1, pcp2, o1, o2, n1, n2)		\
+({									\
+	char __ret;							\
+	typeof(pcp1) __o1 = (o1), __n1 = (n1);				\
+	typeof(pcp2) __o2 = (o2), __n2 = (n2);				\
+	asm volatile("cmpxchg8b "__percpu_arg(1)"\n\tsetz %0\n\t"	\
+		    : "=a" (__ret), "+m" (pcp1), "+m" (pcp2), "+d" (__o2) \
+		    :  "b" (__n1), "c" (__n2), "a" (__o1));		\
+	__ret;								\
+})
+
+#define irqsafe_cpu_cmpxchg_double_4(pcp1, pcp2, o1, o2, n1, n2)	\
+	(cpu_has_cx8 ?							\
+	 percpu_cmpxchg8b_double(pcp1, pcp2, o1, o2, n1, n2) :		\
+	 irqsafe_cpu_generic_cmpxchg_double(pcp1, pcp2, o1, o2, n1, n2))
+#endif
+
 /*
  * Per cpu atomic 64 bit operations are only available under 64 bit.
  * 32 bit must fall back to generic operations.
@@ -324,6 +346,26 @@ do {									\
 #define irqsafe_cpu_or_8(pcp, val)	percpu_to_op("or", (pcp), val)
 #define irqsafe_cpu_xor_8(pcp, val)	percpu_to_op("xor", (pcp), val)
 
+/*
+ * cmpxchg16b of two adjacent per cpu words. Early AMD64 processors do
+ * not have the instruction and use the generic irq disabling version.
+ */
+#define percpu_cmpxchg16b_double(pcp1, pcp2, o1, o2, n1, n2)		\
+({									\
+	char __ret;							\
+	typeof(pcp1) __o1 = (o1), __n1 = (n1);				\
+	typeof(pcp2) __o2 = (o2), __n2 = (n2);				\
+	asm volatile("cmpxchg16b "__percpu_arg(1)"\n\tsetz %0\n\t"	\
+		    : "=a" (__ret), "+m" (pcp1), "+m" (pcp2), "+d" (__o2) \
+		    :  "b" (__n1), "c" (__n2), "a" (__o1));		\
+	__ret;								\
+})
+
+#define irqsafe_cpu_cmpxchg_double_8(pcp1, pcp2, o1, o2, n1, n2)	\
+	(cpu_has_cx16 ?							\
+	 percpu_cmpxchg16b_double(pcp1, pcp2, o1, o2, n1, n2) :		\
+	 irqsafe_cpu_generic_cmpxchg_double(pcp1, pcp2, o1, o2, n1, n2))
+
 #endif
 
 /* This is not atomic against other CPUs -- CPU preemption needs to be off */
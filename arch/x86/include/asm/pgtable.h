@@ -216,6 +216,31 @@ static inline pte_t pte_mkspecial(pte_t pte)
 	return pte_set_flags(pte, _PAGE_SPECIAL);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * NUMA hinting ptes keep everything but _PAGE_PRESENT, so that the next
+ * access traps into do_numa_page() while pte_present() stays true for
+ * the rest of the VM.  They must only be tested for in vmas that allow
+ * access, as they look exactly like a PROT_NONE pte.
+ */
+static inline int pte_numa(pte_t pte)
+{
+	return (pte_flags(pte) & (_PAGE_NUMA | _PAGE_PRESENT)) == _PAGE_NUMA;
+}
+
+static inline pte_t pte_mknuma(pte_t pte)
+{
+	pte = pte_set_flags(pte, _PAGE_NUMA);
+	return pte_clear_flags(pte, _PAGE_PRESENT);
+}
+
+static inline pte_t pte_mknonnuma(pte_t pte)
+{
+	pte = pte_clear_flags(pte, _PAGE_NUMA);
+	return pte_set_flags(pte, _PAGE_PRESENT | _PAGE_ACCESSED);
+}
+#endif
+
 /*
  * Mask out unsupported bits in a present pgprot.  Non-present pgprots
  * can use those bits for other purposes, so leave them be.
@@ -347,10 +347,11 @@
 #define __NR_fanotify_mark	339
 #define __NR_prlimit64		340
 #define __NR_clock_adjtime	341
+#define __NR_syncfs		342
 
 #ifdef __KERNEL__
 
-#define NR_syscalls 342
+#define NR_syscalls 343
 
 #define __ARCH_WANT_IPC_PARSE_VERSION
 #define __ARCH_WANT_OLD_READDIR
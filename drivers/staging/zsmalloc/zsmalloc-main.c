@@ -0,0 +1,932 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * This allocator is designed for use with zram. Compressed pages are
+ * mostly between a few hundred bytes and 3/4 of a page, so allocating
+ * each of them from kmalloc() or xvmalloc() wastes a lot of memory,
+ * either through internal fragmentation or through free space left in
+ * pages that cannot be reused.
+ *
+ * zsmalloc groups objects into size classes spaced ZS_SIZE_CLASS_DELTA
+ * bytes apart. Each class allocates "zspages": groups of up to
+ * ZS_MAX_PAGES_PER_ZSPAGE 0-order pages whose combined size is a near
+ * multiple of the class size, so objects are allowed to span page
+ * boundaries and almost no space is lost at the end of a page.
+ *
+ * Objects are referred to by an opaque handle. The handle is a small
+ * slab object holding the current (<PFN>, <obj_idx>) location of the
+ * object; the object in turn starts with a copy of its handle. This
+ * indirection allows zs_compact() to move objects out of sparsely used
+ * zspages and free them. Users must map an object with zs_map_object()
+ * to access it; the mapping pins the object in place until it is
+ * released with zs_unmap_object().
+ *
+ * Usage of struct page fields:
+ *	page->private: points to the struct zspage the page belongs to
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/cpu.h>
+#include <linux/percpu.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *handle_cachep;
+
+/* per-cpu VM mapping areas for zspage accesses that cross page boundaries */
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static struct zspage *get_zspage(struct page *page)
+{
+	return (struct zspage *)page_private(page);
+}
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * For each size class, zspages are divided into different groups
+ * depending on how "full" they are. This was done so that we could
+ * easily find empty or nearly empty zspages when we try to shrink
+ * the pool (see zs_compact()). This function returns fullness
+ * status of the given page.
+ */
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	int inuse, max_objects;
+
+	inuse = zspage->inuse;
+	max_objects = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objects)
+		return ZS_FULL;
+	if (inuse <= max_objects / fullness_threshold_frac)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+static void insert_zspage(struct size_class *class, struct zspage *zspage,
+			enum fullness_group fullness)
+{
+	zspage->fullness = fullness;
+	if (fullness >= _ZS_NR_FULLNESS_GROUPS)
+		return;
+
+	list_add(&zspage->list, &class->fullness_list[fullness]);
+}
+
+static void remove_zspage(struct size_class *class, struct zspage *zspage)
+{
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del_init(&zspage->list);
+}
+
+/*
+ * Each size class maintains zspages in different fullness groups depending
+ * on the number of live objects they contain. When allocating or freeing
+ * objects, the fullness status of the page can change, say, from ALMOST_FULL
+ * to ALMOST_EMPTY when freeing an object. This function checks if such
+ * a status change has occurred for the given page and accordingly moves the
+ * page from the freelist of the old fullness group to that of the new
+ * fullness group.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg;
+
+	newfg = get_fullness_group(class, zspage);
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	remove_zspage(class, zspage);
+	insert_zspage(class, zspage, newfg);
+
+	return newfg;
+}
+
+/*
+ * We have to decide on how many pages to link together
+ * to form a zspage for each size class. This is important
+ * to reduce wastage due to unusable space left at end of
+ * each zspage which is given as:
+ *	wastage = Zp - Zp % size_class
+ * where Zp = zspage size = k * PAGE_SIZE where k = 1, 2, ...
+ *
+ * For example, for size class of 3/8 * PAGE_SIZE, we should
+ * link together 3 PAGE_SIZE sized pages to form a zspage
+ * since then we can perfectly fit in 8 such objects.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	/* zspage order which gives maximum used size per KB */
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size;
+		int waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+/* Encode <page, obj_idx> as a single handle value */
+static unsigned long location_to_obj(struct page *page, unsigned int obj_idx)
+{
+	unsigned long obj;
+
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= obj_idx & OBJ_INDEX_MASK;
+	obj <<= OBJ_TAG_BITS;
+
+	return obj;
+}
+
+/* Decode <page, obj_idx> pair from the given object handle */
+static void obj_to_location(unsigned long obj, struct page **page,
+				unsigned int *obj_idx)
+{
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = obj & OBJ_INDEX_MASK;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~BIT(HANDLE_PIN_BIT);
+}
+
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*(unsigned long *)handle = obj;
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static unsigned long cache_alloc_handle(struct zs_pool *pool)
+{
+	return (unsigned long)kmem_cache_alloc(handle_cachep,
+			pool->flags & ~__GFP_HIGHMEM);
+}
+
+static void cache_free_handle(unsigned long handle)
+{
+	kmem_cache_free(handle_cachep, (void *)handle);
+}
+
+/*
+ * Return a pointer to the head of object obj_idx. The caller must
+ * kunmap_atomic() the returned address. Object heads never span
+ * pages since all class sizes are multiples of ZS_ALIGN.
+ */
+static unsigned long *obj_head_map(struct size_class *class,
+				struct zspage *zspage, unsigned int obj_idx)
+{
+	unsigned long off = (unsigned long)obj_idx * class->size;
+	void *vaddr;
+
+	vaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	return vaddr + (off & ~PAGE_MASK);
+}
+
+static void obj_head_unmap(unsigned long *head)
+{
+	kunmap_atomic(head, KM_USER0);
+}
+
+/* Take the first free object of zspage and tag it with its handle */
+static unsigned long obj_malloc(struct size_class *class,
+				struct zspage *zspage, unsigned long handle)
+{
+	unsigned int obj_idx = zspage->freeobj;
+	unsigned long *head;
+
+	head = obj_head_map(class, zspage, obj_idx);
+	zspage->freeobj = *head >> OBJ_TAG_BITS;
+	*head = handle | OBJ_ALLOCATED_TAG;
+	obj_head_unmap(head);
+
+	zspage->inuse++;
+	class->objs_used++;
+
+	return location_to_obj(zspage->pages[0], obj_idx);
+}
+
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx)
+{
+	unsigned long *head;
+
+	/* Insert this object in containing zspage's freelist */
+	head = obj_head_map(class, zspage, obj_idx);
+	*head = (unsigned long)zspage->freeobj << OBJ_TAG_BITS;
+	obj_head_unmap(head);
+
+	zspage->freeobj = obj_idx;
+	zspage->inuse--;
+	class->objs_used--;
+}
+
+static void free_zspage(struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < ZS_MAX_PAGES_PER_ZSPAGE && zspage->pages[i]; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+/* Initialize a newly allocated zspage */
+static void init_zspage(struct size_class *class, struct zspage *zspage)
+{
+	unsigned int i;
+	unsigned long *head;
+
+	/* chain all objects into the free list, in ascending order */
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		head = obj_head_map(class, zspage, i);
+		*head = (unsigned long)(i + 1) << OBJ_TAG_BITS;
+		obj_head_unmap(head);
+	}
+
+	/* a freeobj of objs_per_zspage marks the end of the list */
+	zspage->freeobj = 0;
+	zspage->inuse = 0;
+}
+
+/*
+ * Allocate a zspage for the given size class
+ */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class_idx = class->index;
+	zspage->fullness = ZS_EMPTY;
+
+	/*
+	 * Allocate individual pages and link them together. The pages
+	 * need not be physically contiguous.
+	 */
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page;
+
+		page = alloc_page(pool->flags);
+		if (!page)
+			goto cleanup;
+
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+
+	init_zspage(class, zspage);
+	return zspage;
+
+cleanup:
+	free_zspage(zspage);
+	return NULL;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = 0; i < _ZS_NR_FULLNESS_GROUPS; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+					struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/*
+ * Map the object in [off, off + size) of the zspage pages. Objects that
+ * fit in a single page are mapped directly; objects that span two pages
+ * are copied into the per-cpu buffer.
+ */
+static void *__zs_map_object(struct mapping_area *area,
+			struct page *pages[2], int off, int size)
+{
+	int sizes[2];
+	void *addr;
+	char *buf = area->vm_buf;
+
+	/* disable page faults to match kmap_atomic() return conditions */
+	pagefault_disable();
+
+	/* no read fastpath */
+	if (area->vm_mm == ZS_MM_WO)
+		goto out;
+
+	sizes[0] = PAGE_SIZE - off;
+	sizes[1] = size - sizes[0];
+
+	/* copy object to per-cpu buffer */
+	addr = kmap_atomic(pages[0], KM_USER0);
+	memcpy(buf, addr + off, sizes[0]);
+	kunmap_atomic(addr, KM_USER0);
+	addr = kmap_atomic(pages[1], KM_USER0);
+	memcpy(buf + sizes[0], addr, sizes[1]);
+	kunmap_atomic(addr, KM_USER0);
+out:
+	return area->vm_buf;
+}
+
+static void __zs_unmap_object(struct mapping_area *area,
+			struct page *pages[2], int off, int size)
+{
+	int sizes[2];
+	void *addr;
+	char *buf = area->vm_buf;
+
+	/* no write fastpath */
+	if (area->vm_mm == ZS_MM_RO)
+		goto out;
+
+	/* the handle is owned by the allocator, do not write it back */
+	buf += ZS_HANDLE_SIZE;
+	size -= ZS_HANDLE_SIZE;
+	off += ZS_HANDLE_SIZE;
+
+	sizes[0] = PAGE_SIZE - off;
+	sizes[1] = size - sizes[0];
+
+	/* copy per-cpu buffer to object */
+	addr = kmap_atomic(pages[0], KM_USER0);
+	memcpy(addr + off, buf, sizes[0]);
+	kunmap_atomic(addr, KM_USER0);
+	addr = kmap_atomic(pages[1], KM_USER0);
+	memcpy(addr, buf + sizes[0], sizes[1]);
+	kunmap_atomic(addr, KM_USER0);
+
+out:
+	/* enable page faults to match kunmap_atomic() return conditions */
+	pagefault_enable();
+}
+
+static int zs_cpu_notifier(struct notifier_block *nb, unsigned long action,
+				void *pcpu)
+{
+	int cpu = (long)pcpu;
+	struct mapping_area *area;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+	case CPU_UP_PREPARE_FROZEN:
+		area = &per_cpu(zs_map_area, cpu);
+		/*
+		 * Make sure we don't leak memory if a cpu UP notification
+		 * and zs_init() race and both call zs_cpu_up() on the same cpu
+		 */
+		if (area->vm_buf)
+			return 0;
+		area->vm_buf = (char *)__get_free_page(GFP_KERNEL);
+		if (!area->vm_buf)
+			return notifier_from_errno(-ENOMEM);
+		break;
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+	case CPU_UP_CANCELED:
+	case CPU_UP_CANCELED_FROZEN:
+		area = &per_cpu(zs_map_area, cpu);
+		if (area->vm_buf)
+			free_page((unsigned long)area->vm_buf);
+		area->vm_buf = NULL;
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block zs_cpu_nb = {
+	.notifier_call = zs_cpu_notifier
+};
+
+static void zs_exit(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
+	unregister_cpu_notifier(&zs_cpu_nb);
+
+	kmem_cache_destroy(handle_cachep);
+}
+
+static int __init zs_init(void)
+{
+	int cpu, ret;
+
+	handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					0, 0, NULL);
+	if (!handle_cachep)
+		return -ENOMEM;
+
+	register_cpu_notifier(&zs_cpu_nb);
+	for_each_online_cpu(cpu) {
+		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
+		if (notifier_to_errno(ret))
+			goto fail;
+	}
+	return 0;
+fail:
+	zs_exit();
+	return notifier_to_errno(ret);
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @flags: allocation flags used to allocate pool metadata
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(gfp_t flags)
+{
+	int i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int size, fg;
+		struct size_class *class;
+
+		size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		if (size > ZS_MAX_ALLOC_SIZE)
+			size = ZS_MAX_ALLOC_SIZE;
+
+		class = &pool->size_class[i];
+		class->size = size;
+		class->index = i;
+		spin_lock_init(&class->lock);
+		class->pages_per_zspage = get_pages_per_zspage(size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / size;
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic_long_set(&pool->pages_compacted, 0);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (list_empty(&class->fullness_list[fg]))
+				continue;
+
+			pr_info("Freeing non-empty class with size %d, fullness group %d\n",
+				class->size, fg);
+		}
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned long handle, obj;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = cache_alloc_handle(pool);
+	if (!handle)
+		return 0;
+
+	/* extra space in chunk to keep the handle */
+	size += ZS_HANDLE_SIZE;
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			cache_free_handle(handle);
+			return 0;
+		}
+
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+		spin_lock(&class->lock);
+		class->objs_allocated += class->objs_per_zspage;
+	}
+
+	obj = obj_malloc(class, zspage, handle);
+	fix_fullness_group(class, zspage);
+	record_obj(handle, obj);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct page *first_page;
+	struct zspage *zspage;
+	unsigned int obj_idx;
+	struct size_class *class;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/* wait for mappers and keep compaction away from this object */
+	pin_tag(handle);
+	obj_to_location(handle_to_obj(handle), &first_page, &obj_idx);
+	zspage = get_zspage(first_page);
+	class = &pool->size_class[zspage->class_idx];
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, obj_idx);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->objs_allocated -= class->objs_per_zspage;
+	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	cache_free_handle(handle);
+
+	if (fullness == ZS_EMPTY) {
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(zspage);
+	}
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode to use
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped using
+ * this function. When done with the object, it must be unmapped using
+ * zs_unmap_object.
+ *
+ * Only one object can be mapped per cpu at a time. There is no protection
+ * against nested mappings.
+ *
+ * This function returns with preemption and page faults disabled, and
+ * the object pinned so that compaction cannot move it.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct page *first_page;
+	struct zspage *zspage;
+	unsigned int obj_idx;
+	unsigned long off;
+	struct size_class *class;
+	struct mapping_area *area;
+	struct page *pages[2];
+	int page_idx;
+	void *ret;
+
+	BUG_ON(!handle);
+
+	/* the pin also disables preemption, keeping us on this cpu */
+	pin_tag(handle);
+
+	obj_to_location(handle_to_obj(handle), &first_page, &obj_idx);
+	zspage = get_zspage(first_page);
+	class = &pool->size_class[zspage->class_idx];
+	off = (unsigned long)obj_idx * class->size;
+
+	area = &__get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+
+	page_idx = off >> PAGE_SHIFT;
+	off &= ~PAGE_MASK;
+	pages[0] = zspage->pages[page_idx];
+	if (off + class->size <= PAGE_SIZE) {
+		/* this object is contained entirely within a page */
+		area->vm_addr = kmap_atomic(pages[0], KM_USER0);
+		ret = area->vm_addr + off;
+		goto out;
+	}
+
+	/* this object spans two pages */
+	pages[1] = zspage->pages[page_idx + 1];
+	ret = __zs_map_object(area, pages, off, class->size);
+out:
+	return ret + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct page *first_page;
+	struct zspage *zspage;
+	unsigned int obj_idx;
+	unsigned long off;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	obj_to_location(handle_to_obj(handle), &first_page, &obj_idx);
+	zspage = get_zspage(first_page);
+	class = &pool->size_class[zspage->class_idx];
+	off = (unsigned long)obj_idx * class->size;
+
+	area = &__get_cpu_var(zs_map_area);
+	if ((off & ~PAGE_MASK) + class->size <= PAGE_SIZE) {
+		kunmap_atomic(area->vm_addr, KM_USER0);
+	} else {
+		struct page *pages[2];
+
+		pages[0] = zspage->pages[off >> PAGE_SHIFT];
+		pages[1] = zspage->pages[(off >> PAGE_SHIFT) + 1];
+		__zs_unmap_object(area, pages, off & ~PAGE_MASK, class->size);
+	}
+
+	unpin_tag(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* Copy object src_idx of src over object dst_idx of dst, page by page */
+static void zs_object_copy(struct size_class *class,
+			struct zspage *dst, unsigned int dst_idx,
+			struct zspage *src, unsigned int src_idx)
+{
+	unsigned long s_off = (unsigned long)src_idx * class->size;
+	unsigned long d_off = (unsigned long)dst_idx * class->size;
+	int left = class->size;
+
+	while (left) {
+		void *s_addr, *d_addr;
+		int size;
+
+		size = min_t(int, left, PAGE_SIZE - (s_off & ~PAGE_MASK));
+		size = min_t(int, size, PAGE_SIZE - (d_off & ~PAGE_MASK));
+
+		s_addr = kmap_atomic(src->pages[s_off >> PAGE_SHIFT], KM_USER0);
+		d_addr = kmap_atomic(dst->pages[d_off >> PAGE_SHIFT], KM_USER1);
+		memcpy(d_addr + (d_off & ~PAGE_MASK),
+			s_addr + (s_off & ~PAGE_MASK), size);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		s_off += size;
+		d_off += size;
+		left -= size;
+	}
+}
+
+/*
+ * A zspage can only be freed by compaction if the free slots of all
+ * other zspages of the class can absorb its objects.
+ */
+static int zs_can_compact(struct size_class *class)
+{
+	return class->objs_allocated - class->objs_used >=
+		class->objs_per_zspage;
+}
+
+/*
+ * Pick a migration source, preferring almost empty zspages. Sources are
+ * taken from the tail of the lists while destinations (find_get_zspage())
+ * come from the head, so the two do not chase each other.
+ */
+static struct zspage *isolate_source_zspage(struct size_class *class)
+{
+	static const enum fullness_group fg[] = {
+		ZS_ALMOST_EMPTY, ZS_ALMOST_FULL
+	};
+	struct zspage *src;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fg); i++) {
+		struct list_head *head = &class->fullness_list[fg[i]];
+
+		if (list_empty(head))
+			continue;
+
+		src = list_entry(head->prev, struct zspage, list);
+		remove_zspage(class, src);
+		return src;
+	}
+
+	return NULL;
+}
+
+/*
+ * Move every object of src into other zspages of the class, filling
+ * the fullest ones first. Returns 1 if src ends up empty. An object
+ * that is currently mapped or being freed cannot be moved; migration
+ * stops there and src keeps its remaining objects.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *src)
+{
+	unsigned int obj_idx;
+
+	for (obj_idx = 0; obj_idx < class->objs_per_zspage && src->inuse;
+			obj_idx++) {
+		unsigned long *head, handle, obj;
+		unsigned int dst_idx;
+		struct zspage *dst;
+
+		head = obj_head_map(class, src, obj_idx);
+		handle = *head;
+		obj_head_unmap(head);
+
+		if (!(handle & OBJ_ALLOCATED_TAG))
+			continue;
+		handle &= ~OBJ_ALLOCATED_TAG;
+
+		dst = find_get_zspage(class);
+		if (!dst)
+			return 0;
+
+		if (!trypin_tag(handle))
+			return 0;
+
+		dst_idx = dst->freeobj;
+		obj = obj_malloc(class, dst, handle);
+		zs_object_copy(class, dst, dst_idx, src, obj_idx);
+		fix_fullness_group(class, dst);
+		obj_free(class, src, obj_idx);
+
+		/* keep the pin bit set until unpin_tag() */
+		record_obj(handle, obj | BIT(HANDLE_PIN_BIT));
+		unpin_tag(handle);
+	}
+
+	return src->inuse == 0;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct zspage *src;
+	unsigned long freed = 0;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class)) {
+		src = isolate_source_zspage(class);
+		if (!src)
+			break;
+
+		if (!migrate_zspage(pool, class, src)) {
+			insert_zspage(class, src,
+				get_fullness_group(class, src));
+			break;
+		}
+
+		class->objs_allocated -= class->objs_per_zspage;
+		free_zspage(src);
+		freed += class->pages_per_zspage;
+
+		cond_resched_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - move objects out of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Objects of each size class are migrated from its least used zspages
+ * into the free slots of the others, and the emptied zspages are
+ * returned to the page allocator. Objects that are mapped at the time
+ * are skipped. Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		struct size_class *class = &pool->size_class[i];
+
+		freed += __zs_compact(pool, class);
+	}
+
+	atomic_long_sub(freed, &pool->pages_allocated);
+	atomic_long_add(freed, &pool->pages_compacted);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	u64 npages = atomic_long_read(&pool->pages_allocated);
+
+	return npages << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/* Number of pages released by zs_compact() over the lifetime of the pool */
+u64 zs_get_compacted_pages(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_compacted_pages);
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Memory allocator for compressed pages");
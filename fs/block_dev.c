@@ -25,6 +25,7 @@
 #include <linux/namei.h>
 #include <linux/log2.h>
 #include <linux/kmemleak.h>
+#include <linux/task_io_accounting_ops.h>
 #include <asm/uaccess.h>
 #include "internal.h"
 
@@ -179,14 +180,156 @@ blkdev_get_blocks(struct inode *inode, sector_t iblock,
 	return 0;
 }
 
+/*
+ * Small synchronous direct I/O to a block device is common enough (raw
+ * devices under databases) that setting up a struct dio for it shows.
+ * Such requests are sent as a single bio built on the stack and waited
+ * for right here.
+ */
+#define DIO_INLINE_BIO_VECS	4
+
+/*
+ * Returns the number of pages spanned by the user buffers if the
+ * request can take the simple path, or 0 if it needs the full
+ * __blockdev_direct_IO() treatment.
+ */
+static int blkdev_dio_simple_pages(struct block_device *bdev,
+				   const struct iovec *iov, loff_t offset,
+				   unsigned long nr_segs)
+{
+	unsigned int mask = bdev_logical_block_size(bdev) - 1;
+	unsigned long seg;
+	size_t count = 0;
+	int nr_pages = 0;
+
+	if (bdev_get_integrity(bdev))
+		return 0;
+	if (offset & mask)
+		return 0;
+
+	for (seg = 0; seg < nr_segs; seg++) {
+		unsigned long addr = (unsigned long)iov[seg].iov_base;
+		size_t len = iov[seg].iov_len;
+
+		if (!len || ((addr | len) & mask))
+			return 0;
+		nr_pages += ((addr + len + PAGE_SIZE - 1) >> PAGE_SHIFT) -
+			    (addr >> PAGE_SHIFT);
+		if (nr_pages > DIO_INLINE_BIO_VECS)
+			return 0;
+		count += len;
+	}
+
+	/* let the full path deal with the end of the device */
+	if (offset + count > i_size_read(bdev->bd_inode))
+		return 0;
+	return nr_pages;
+}
+
+static void blkdev_bio_end_io_simple(struct bio *bio, int error)
+{
+	struct task_struct *waiter = bio->bi_private;
+
+	/* the bio lives on the waiter's stack: don't touch it after this */
+	bio->bi_private = NULL;
+	wake_up_process(waiter);
+}
+
+/*
+ * Returns -ENOTBLK if the request turned out not to fit in one bio, in
+ * which case nothing has been submitted and the caller falls back.
+ */
+static ssize_t
+__blkdev_direct_IO_simple(int rw, struct block_device *bdev,
+			  const struct iovec *iov, loff_t offset,
+			  unsigned long nr_segs)
+{
+	struct bio_vec vecs[DIO_INLINE_BIO_VECS];
+	struct page *pages[DIO_INLINE_BIO_VECS];
+	struct bio bio;
+	unsigned long seg;
+	int nr_pinned = 0, i;
+	size_t count = 0;
+	ssize_t ret;
+
+	bio_init(&bio);
+	bio.bi_io_vec = vecs;
+	bio.bi_max_vecs = DIO_INLINE_BIO_VECS;
+	bio.bi_bdev = bdev;
+	bio.bi_sector = offset >> 9;
+	bio.bi_private = current;
+	bio.bi_end_io = blkdev_bio_end_io_simple;
+
+	for (seg = 0; seg < nr_segs; seg++) {
+		unsigned long addr = (unsigned long)iov[seg].iov_base;
+		size_t len = iov[seg].iov_len;
+		int n, got;
+
+		n = ((addr + len + PAGE_SIZE - 1) >> PAGE_SHIFT) -
+		    (addr >> PAGE_SHIFT);
+		got = get_user_pages_fast(addr, n, !(rw & WRITE),
+					  pages + nr_pinned);
+		if (got > 0)
+			nr_pinned += got;
+		if (got < n) {
+			ret = got < 0 ? got : -EFAULT;
+			goto out;
+		}
+
+		for (i = nr_pinned - n; i < nr_pinned; i++) {
+			unsigned int off = addr & ~PAGE_MASK;
+			unsigned int bytes = min_t(size_t, PAGE_SIZE - off, len);
+
+			if (bio_add_page(&bio, pages[i], bytes, off) != bytes) {
+				ret = -ENOTBLK;
+				goto out;
+			}
+			addr += bytes;
+			len -= bytes;
+		}
+		count += iov[seg].iov_len;
+	}
+
+	if (rw & WRITE)
+		task_io_account_write(count);
+
+	submit_bio((rw & WRITE) ? WRITE_SYNC : READ_SYNC, &bio);
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!ACCESS_ONCE(bio.bi_private))
+			break;
+		io_schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	ret = test_bit(BIO_UPTODATE, &bio.bi_flags) ? count : -EIO;
+out:
+	for (i = 0; i < nr_pinned; i++) {
+		if (!(rw & WRITE) && ret > 0 && !PageCompound(pages[i]))
+			set_page_dirty_lock(pages[i]);
+		page_cache_release(pages[i]);
+	}
+	return ret;
+}
+
 static ssize_t
 blkdev_direct_IO(int rw, struct kiocb *iocb, const struct iovec *iov,
 			loff_t offset, unsigned long nr_segs)
 {
 	struct file *file = iocb->ki_filp;
 	struct inode *inode = file->f_mapping->host;
+	struct block_device *bdev = I_BDEV(inode);
+
+	if (is_sync_kiocb(iocb) &&
+	    blkdev_dio_simple_pages(bdev, iov, offset, nr_segs)) {
+		ssize_t ret;
+
+		ret = __blkdev_direct_IO_simple(rw, bdev, iov, offset, nr_segs);
+		if (ret != -ENOTBLK)
+			return ret;
+	}
 
-	return __blockdev_direct_IO(rw, iocb, inode, I_BDEV(inode), iov, offset,
+	return __blockdev_direct_IO(rw, iocb, inode, bdev, iov, offset,
 				    nr_segs, blkdev_get_blocks, NULL, NULL, 0);
 }
 
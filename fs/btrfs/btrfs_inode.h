@@ -155,9 +155,13 @@ struct btrfs_inode {
 	unsigned dummy_inode:1;
 
 	/*
-	 * always compress this one file
+	 * always compress this one file, with the given
+	 * BTRFS_COMPRESS_* method
 	 */
-	unsigned force_compress:1;
+	unsigned force_compress:4;
+
+	/* pending inode item and dir index updates, see delayed-inode.c */
+	struct btrfs_delayed_node *delayed_node;
 
 	struct inode vfs_inode;
 };
@@ -0,0 +1,1479 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/radix-tree.h>
+#include "delayed-inode.h"
+#include "disk-io.h"
+#include "transaction.h"
+#include "btrfs_inode.h"
+
+/*
+ * Delayed inode items
+ *
+ * Updating the inode item and inserting or deleting dir index items
+ * means a btree search under tree locks for every change.  Instead, those
+ * updates are staged in a per-inode btrfs_delayed_node:
+ *
+ * - the latest copy of the inode item, so repeated updates of the same
+ *   inode in a transaction only touch the btree once
+ * - the dir index items to insert and to delete, sorted by key.  Deleting
+ *   an index that is still queued for insertion cancels both
+ *
+ * The pending items are written to the btree in batches, by the
+ * delayed-meta workers once enough of them pile up, and at the latest
+ * during transaction commit.  Anybody who reads those items straight from
+ * the btree (fsync logging, snapshots, readdir) either flushes the node
+ * first or merges the pending items into what it finds.
+ *
+ * Metadata space for every pending item is moved from the reservation of
+ * the transaction that queued it into fs_info->delayed_block_rsv, and the
+ * flush consumes it from there.  When that isn't possible the caller
+ * updates the btree directly.
+ */
+
+static struct kmem_cache *delayed_node_cache;
+
+int __init btrfs_delayed_inode_init(void)
+{
+	delayed_node_cache = kmem_cache_create("btrfs_delayed_node",
+					sizeof(struct btrfs_delayed_node),
+					0,
+					SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD,
+					NULL);
+	if (!delayed_node_cache)
+		return -ENOMEM;
+	return 0;
+}
+
+void btrfs_delayed_inode_exit(void)
+{
+	if (delayed_node_cache)
+		kmem_cache_destroy(delayed_node_cache);
+}
+
+static inline struct btrfs_delayed_root *
+btrfs_get_delayed_root(struct btrfs_root *root)
+{
+	return root->fs_info->delayed_root;
+}
+
+/*
+ * the tree root (free space cache inodes), the data relocation tree and
+ * log replay keep updating the btree directly
+ */
+static inline int btrfs_delayed_items_allowed(struct btrfs_root *root)
+{
+	return root->ref_cows &&
+	       root->root_key.objectid != BTRFS_DATA_RELOC_TREE_OBJECTID &&
+	       !root->fs_info->log_root_recovering;
+}
+
+static inline void btrfs_init_delayed_node(
+				struct btrfs_delayed_node *delayed_node,
+				struct btrfs_root *root, u64 inode_id)
+{
+	delayed_node->root = root;
+	delayed_node->inode_id = inode_id;
+	atomic_set(&delayed_node->refs, 0);
+	delayed_node->count = 0;
+	delayed_node->in_list = false;
+	delayed_node->inode_dirty = false;
+	delayed_node->ins_root = RB_ROOT;
+	delayed_node->del_root = RB_ROOT;
+	mutex_init(&delayed_node->mutex);
+	delayed_node->index_cnt = 0;
+	INIT_LIST_HEAD(&delayed_node->n_list);
+	INIT_LIST_HEAD(&delayed_node->p_list);
+	delayed_node->bytes_reserved = 0;
+}
+
+/*
+ * returns the delayed node of the inode with a reference held, or NULL
+ * if there is none
+ */
+static struct btrfs_delayed_node *btrfs_get_delayed_node(struct inode *inode)
+{
+	struct btrfs_inode *btrfs_inode = BTRFS_I(inode);
+	struct btrfs_root *root = btrfs_inode->root;
+	struct btrfs_delayed_node *node;
+
+	node = ACCESS_ONCE(btrfs_inode->delayed_node);
+	if (node) {
+		atomic_inc(&node->refs);
+		return node;
+	}
+
+	spin_lock(&root->inode_lock);
+	node = radix_tree_lookup(&root->delayed_nodes_tree, inode->i_ino);
+	if (node) {
+		if (btrfs_inode->delayed_node) {
+			BUG_ON(btrfs_inode->delayed_node != node);
+			atomic_inc(&node->refs);	/* can be accessed */
+			spin_unlock(&root->inode_lock);
+			return node;
+		}
+		btrfs_inode->delayed_node = node;
+		atomic_inc(&node->refs);	/* can be accessed */
+		atomic_inc(&node->refs);	/* cached in the btrfs inode */
+	}
+	spin_unlock(&root->inode_lock);
+
+	return node;
+}
+
+static struct btrfs_delayed_node *
+btrfs_get_or_create_delayed_node(struct inode *inode)
+{
+	struct btrfs_delayed_node *node;
+	struct btrfs_inode *btrfs_inode = BTRFS_I(inode);
+	struct btrfs_root *root = btrfs_inode->root;
+	int ret;
+
+again:
+	node = btrfs_get_delayed_node(inode);
+	if (node)
+		return node;
+
+	node = kmem_cache_alloc(delayed_node_cache, GFP_NOFS);
+	if (!node)
+		return ERR_PTR(-ENOMEM);
+	btrfs_init_delayed_node(node, root, inode->i_ino);
+
+	atomic_inc(&node->refs);	/* cached in the btrfs inode */
+	atomic_inc(&node->refs);	/* can be accessed */
+
+	ret = radix_tree_preload(GFP_NOFS & ~__GFP_HIGHMEM);
+	if (ret) {
+		kmem_cache_free(delayed_node_cache, node);
+		return ERR_PTR(ret);
+	}
+
+	spin_lock(&root->inode_lock);
+	ret = radix_tree_insert(&root->delayed_nodes_tree, inode->i_ino, node);
+	if (ret == -EEXIST) {
+		spin_unlock(&root->inode_lock);
+		kmem_cache_free(delayed_node_cache, node);
+		radix_tree_preload_end();
+		goto again;
+	}
+	btrfs_inode->delayed_node = node;
+	spin_unlock(&root->inode_lock);
+	radix_tree_preload_end();
+
+	return node;
+}
+
+/*
+ * add the node to the delayed root's lists if it isn't there yet.  When
+ * the node was modified and an async worker already took it off the
+ * prepare list, put it back so the new items get flushed as well.
+ *
+ * Call it with delayed_node->mutex held.
+ */
+static void btrfs_queue_delayed_node(struct btrfs_delayed_root *root,
+				     struct btrfs_delayed_node *node,
+				     int mod)
+{
+	spin_lock(&root->lock);
+	if (node->in_list) {
+		if (!list_empty(&node->p_list))
+			list_move_tail(&node->p_list, &root->prepare_list);
+		else if (mod)
+			list_add_tail(&node->p_list, &root->prepare_list);
+	} else {
+		list_add_tail(&node->n_list, &root->node_list);
+		list_add_tail(&node->p_list, &root->prepare_list);
+		atomic_inc(&node->refs);	/* inserted into the list */
+		root->nodes++;
+		node->in_list = true;
+	}
+	spin_unlock(&root->lock);
+}
+
+/* Call it with delayed_node->mutex held */
+static void btrfs_dequeue_delayed_node(struct btrfs_delayed_root *root,
+				       struct btrfs_delayed_node *node)
+{
+	spin_lock(&root->lock);
+	if (node->in_list) {
+		root->nodes--;
+		atomic_dec(&node->refs);	/* not in the list */
+		list_del_init(&node->n_list);
+		if (!list_empty(&node->p_list))
+			list_del_init(&node->p_list);
+		node->in_list = false;
+	}
+	spin_unlock(&root->lock);
+}
+
+static struct btrfs_delayed_node *
+btrfs_first_delayed_node(struct btrfs_delayed_root *delayed_root)
+{
+	struct btrfs_delayed_node *node = NULL;
+
+	spin_lock(&delayed_root->lock);
+	if (list_empty(&delayed_root->node_list))
+		goto out;
+
+	node = list_entry(delayed_root->node_list.next,
+			  struct btrfs_delayed_node, n_list);
+	atomic_inc(&node->refs);
+out:
+	spin_unlock(&delayed_root->lock);
+
+	return node;
+}
+
+static struct btrfs_delayed_node *
+btrfs_next_delayed_node(struct btrfs_delayed_node *node)
+{
+	struct btrfs_delayed_root *delayed_root;
+	struct list_head *p;
+	struct btrfs_delayed_node *next = NULL;
+
+	delayed_root = btrfs_get_delayed_root(node->root);
+	spin_lock(&delayed_root->lock);
+	if (!node->in_list) {
+		/* the node was dequeued, start over */
+		if (list_empty(&delayed_root->node_list))
+			goto out;
+		p = delayed_root->node_list.next;
+	} else if (list_is_last(&node->n_list, &delayed_root->node_list)) {
+		goto out;
+	} else {
+		p = node->n_list.next;
+	}
+
+	next = list_entry(p, struct btrfs_delayed_node, n_list);
+	atomic_inc(&next->refs);
+out:
+	spin_unlock(&delayed_root->lock);
+
+	return next;
+}
+
+static void __btrfs_release_delayed_node(
+				struct btrfs_delayed_node *delayed_node,
+				int mod)
+{
+	struct btrfs_delayed_root *delayed_root;
+	struct btrfs_root *root;
+
+	if (!delayed_node)
+		return;
+
+	delayed_root = btrfs_get_delayed_root(delayed_node->root);
+
+	mutex_lock(&delayed_node->mutex);
+	if (delayed_node->count)
+		btrfs_queue_delayed_node(delayed_root, delayed_node, mod);
+	else
+		btrfs_dequeue_delayed_node(delayed_root, delayed_node);
+	mutex_unlock(&delayed_node->mutex);
+
+	if (atomic_dec_and_test(&delayed_node->refs)) {
+		root = delayed_node->root;
+		spin_lock(&root->inode_lock);
+		/* somebody may have found it in the radix tree meanwhile */
+		if (atomic_read(&delayed_node->refs) == 0) {
+			radix_tree_delete(&root->delayed_nodes_tree,
+					  delayed_node->inode_id);
+			kmem_cache_free(delayed_node_cache, delayed_node);
+		}
+		spin_unlock(&root->inode_lock);
+	}
+}
+
+static inline void btrfs_release_delayed_node(struct btrfs_delayed_node *node)
+{
+	__btrfs_release_delayed_node(node, 0);
+}
+
+/* hands out the nodes nobody is flushing yet to the async workers */
+static struct btrfs_delayed_node *
+btrfs_first_prepared_delayed_node(struct btrfs_delayed_root *delayed_root)
+{
+	struct list_head *p;
+	struct btrfs_delayed_node *node = NULL;
+
+	spin_lock(&delayed_root->lock);
+	if (list_empty(&delayed_root->prepare_list))
+		goto out;
+
+	p = delayed_root->prepare_list.next;
+	list_del_init(p);
+	node = list_entry(p, struct btrfs_delayed_node, p_list);
+	atomic_inc(&node->refs);
+out:
+	spin_unlock(&delayed_root->lock);
+
+	return node;
+}
+
+static inline void btrfs_release_prepared_delayed_node(
+					struct btrfs_delayed_node *node)
+{
+	__btrfs_release_delayed_node(node, 1);
+}
+
+static struct btrfs_delayed_item *btrfs_alloc_delayed_item(u32 data_len)
+{
+	struct btrfs_delayed_item *item;
+
+	item = kmalloc(sizeof(*item) + data_len, GFP_NOFS);
+	if (item) {
+		item->data_len = data_len;
+		item->ins_or_del = 0;
+		item->bytes_reserved = 0;
+		item->delayed_node = NULL;
+		atomic_set(&item->refs, 1);
+	}
+	return item;
+}
+
+static struct btrfs_delayed_item *
+__btrfs_lookup_delayed_item(struct rb_root *root, struct btrfs_key *key)
+{
+	struct rb_node *node = root->rb_node;
+	struct btrfs_delayed_item *item;
+	int cmp;
+
+	while (node) {
+		item = rb_entry(node, struct btrfs_delayed_item, rb_node);
+		cmp = btrfs_comp_cpu_keys(&item->key, key);
+		if (cmp < 0)
+			node = node->rb_right;
+		else if (cmp > 0)
+			node = node->rb_left;
+		else
+			return item;
+	}
+	return NULL;
+}
+
+static int __btrfs_add_delayed_item(struct btrfs_delayed_node *delayed_node,
+				    struct btrfs_delayed_item *ins,
+				    int action)
+{
+	struct rb_node **p, *node;
+	struct rb_node *parent_node = NULL;
+	struct rb_root *root;
+	struct btrfs_delayed_item *item;
+	int cmp;
+
+	if (action == BTRFS_DELAYED_INSERTION_ITEM)
+		root = &delayed_node->ins_root;
+	else if (action == BTRFS_DELAYED_DELETION_ITEM)
+		root = &delayed_node->del_root;
+	else
+		BUG();
+	p = &root->rb_node;
+	node = &ins->rb_node;
+
+	while (*p) {
+		parent_node = *p;
+		item = rb_entry(parent_node, struct btrfs_delayed_item,
+				rb_node);
+
+		cmp = btrfs_comp_cpu_keys(&item->key, &ins->key);
+		if (cmp < 0)
+			p = &(*p)->rb_right;
+		else if (cmp > 0)
+			p = &(*p)->rb_left;
+		else
+			return -EEXIST;
+	}
+
+	rb_link_node(node, parent_node, p);
+	rb_insert_color(node, root);
+	ins->delayed_node = delayed_node;
+	ins->ins_or_del = action;
+
+	if (ins->key.type == BTRFS_DIR_INDEX_KEY &&
+	    action == BTRFS_DELAYED_INSERTION_ITEM &&
+	    ins->key.offset >= delayed_node->index_cnt)
+		delayed_node->index_cnt = ins->key.offset + 1;
+
+	delayed_node->count++;
+	atomic_inc(&btrfs_get_delayed_root(delayed_node->root)->items);
+	return 0;
+}
+
+static void finish_one_item(struct btrfs_delayed_root *delayed_root)
+{
+	int seq = atomic_dec_return(&delayed_root->items);
+
+	if (seq < BTRFS_DELAYED_BACKGROUND &&
+	    waitqueue_active(&delayed_root->wait))
+		wake_up(&delayed_root->wait);
+}
+
+static void __btrfs_remove_delayed_item(struct btrfs_delayed_item *item)
+{
+	struct btrfs_delayed_node *delayed_node = item->delayed_node;
+	struct rb_root *root;
+
+	BUG_ON(!delayed_node);
+
+	if (item->ins_or_del == BTRFS_DELAYED_INSERTION_ITEM)
+		root = &delayed_node->ins_root;
+	else
+		root = &delayed_node->del_root;
+
+	rb_erase(&item->rb_node, root);
+	delayed_node->count--;
+	finish_one_item(btrfs_get_delayed_root(delayed_node->root));
+}
+
+static void btrfs_release_delayed_item(struct btrfs_delayed_item *item)
+{
+	if (item) {
+		__btrfs_remove_delayed_item(item);
+		if (atomic_dec_and_test(&item->refs))
+			kfree(item);
+	}
+}
+
+static struct btrfs_delayed_item *
+__btrfs_first_delayed_insertion_item(struct btrfs_delayed_node *node)
+{
+	struct rb_node *p = rb_first(&node->ins_root);
+
+	if (!p)
+		return NULL;
+	return rb_entry(p, struct btrfs_delayed_item, rb_node);
+}
+
+static struct btrfs_delayed_item *
+__btrfs_first_delayed_deletion_item(struct btrfs_delayed_node *node)
+{
+	struct rb_node *p = rb_first(&node->del_root);
+
+	if (!p)
+		return NULL;
+	return rb_entry(p, struct btrfs_delayed_item, rb_node);
+}
+
+static struct btrfs_delayed_item *
+__btrfs_next_delayed_item(struct btrfs_delayed_item *item)
+{
+	struct rb_node *p = rb_next(&item->rb_node);
+
+	if (!p)
+		return NULL;
+	return rb_entry(p, struct btrfs_delayed_item, rb_node);
+}
+
+/*
+ * move the space for one item update out of the transaction's
+ * reservation, the flush uses it later on
+ */
+static int btrfs_delayed_reserve_metadata(struct btrfs_trans_handle *trans,
+					  struct btrfs_root *root,
+					  u64 *bytes_reserved)
+{
+	struct btrfs_block_rsv *src_rsv = trans->block_rsv;
+	struct btrfs_block_rsv *dst_rsv = &root->fs_info->delayed_block_rsv;
+	u64 num_bytes;
+	int ret;
+
+	if (!src_rsv || src_rsv == dst_rsv)
+		return -ENOSPC;
+
+	num_bytes = btrfs_calc_trans_metadata_size(root, 1);
+	ret = btrfs_block_rsv_migrate(src_rsv, dst_rsv, num_bytes);
+	if (!ret)
+		*bytes_reserved = num_bytes;
+	return ret;
+}
+
+static void btrfs_delayed_release_metadata(struct btrfs_root *root,
+					   u64 *bytes_reserved)
+{
+	if (!*bytes_reserved)
+		return;
+
+	btrfs_block_rsv_release(root, &root->fs_info->delayed_block_rsv,
+				*bytes_reserved);
+	*bytes_reserved = 0;
+}
+
+static inline void btrfs_delayed_item_release_metadata(
+					struct btrfs_root *root,
+					struct btrfs_delayed_item *item)
+{
+	btrfs_delayed_release_metadata(root, &item->bytes_reserved);
+}
+
+static void btrfs_release_delayed_inode(struct btrfs_delayed_node *node)
+{
+	if (node->inode_dirty) {
+		btrfs_delayed_release_metadata(node->root,
+					       &node->bytes_reserved);
+		node->inode_dirty = false;
+		node->count--;
+		finish_one_item(btrfs_get_delayed_root(node->root));
+	}
+}
+
+/*
+ * insert the first pending item and as many of the following ones as fit
+ * into the same leaf.  They are only packed while they sort before the key
+ * that already sits at the insertion slot.
+ */
+static int btrfs_batch_insert_items(struct btrfs_trans_handle *trans,
+				    struct btrfs_root *root,
+				    struct btrfs_path *path,
+				    struct btrfs_delayed_item *item)
+{
+	struct btrfs_key keys[BTRFS_DELAYED_BATCH];
+	u32 data_size[BTRFS_DELAYED_BATCH];
+	struct btrfs_delayed_item *curr, *next;
+	struct extent_buffer *leaf;
+	struct btrfs_key next_key;
+	u32 total_data = 0;
+	u32 total_size = 0;
+	int has_next_key = 0;
+	int free_space;
+	int slot;
+	int nr = 0;
+	int i;
+	int ret;
+
+	ret = btrfs_search_slot(trans, root, &item->key, path,
+				item->data_len + sizeof(struct btrfs_item), 1);
+	if (ret == 0)
+		return -EEXIST;
+	if (ret < 0)
+		return ret;
+
+	leaf = path->nodes[0];
+	slot = path->slots[0];
+	free_space = btrfs_leaf_free_space(root, leaf);
+	if (slot < btrfs_header_nritems(leaf)) {
+		btrfs_item_key_to_cpu(leaf, &next_key, slot);
+		has_next_key = 1;
+	}
+
+	curr = item;
+	while (curr && nr < BTRFS_DELAYED_BATCH) {
+		u32 size = curr->data_len + sizeof(struct btrfs_item);
+
+		if (total_size + size > free_space)
+			break;
+		if (has_next_key &&
+		    btrfs_comp_cpu_keys(&curr->key, &next_key) >= 0)
+			break;
+
+		keys[nr] = curr->key;
+		data_size[nr] = curr->data_len;
+		total_data += curr->data_len;
+		total_size += size;
+		nr++;
+		curr = __btrfs_next_delayed_item(curr);
+	}
+	BUG_ON(nr == 0);
+
+	ret = setup_items_for_insert(trans, root, path, keys, data_size,
+				     total_data, total_size, nr);
+	if (ret)
+		return ret;
+
+	leaf = path->nodes[0];
+	curr = item;
+	for (i = 0; i < nr; i++) {
+		next = __btrfs_next_delayed_item(curr);
+		write_extent_buffer(leaf, curr->data,
+				    btrfs_item_ptr_offset(leaf, slot + i),
+				    curr->data_len);
+		btrfs_delayed_item_release_metadata(root, curr);
+		btrfs_release_delayed_item(curr);
+		curr = next;
+	}
+	btrfs_mark_buffer_dirty(leaf);
+
+	return 0;
+}
+
+static int btrfs_insert_delayed_items(struct btrfs_trans_handle *trans,
+				      struct btrfs_path *path,
+				      struct btrfs_root *root,
+				      struct btrfs_delayed_node *node)
+{
+	struct btrfs_delayed_item *curr;
+	int ret = 0;
+
+	while ((curr = __btrfs_first_delayed_insertion_item(node))) {
+		ret = btrfs_batch_insert_items(trans, root, path, curr);
+		btrfs_release_path(root, path);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+/*
+ * the path points to the first pending deletion item, delete it together
+ * with the following items of the leaf that are pending deletion as well
+ */
+static int btrfs_batch_delete_items(struct btrfs_trans_handle *trans,
+				    struct btrfs_root *root,
+				    struct btrfs_path *path,
+				    struct btrfs_delayed_item *item)
+{
+	struct btrfs_delayed_item *curr, *next;
+	struct extent_buffer *leaf;
+	struct btrfs_key key;
+	struct list_head head;
+	int nritems, i, last_item;
+	int ret = 0;
+
+	BUG_ON(!path->nodes[0]);
+
+	leaf = path->nodes[0];
+	i = path->slots[0];
+	last_item = btrfs_header_nritems(leaf) - 1;
+	if (i > last_item)
+		return -ENOENT;
+
+	INIT_LIST_HEAD(&head);
+	nritems = 0;
+	curr = item;
+	while (curr && i <= last_item) {
+		btrfs_item_key_to_cpu(leaf, &key, i);
+		if (btrfs_comp_cpu_keys(&curr->key, &key))
+			break;
+		list_add_tail(&curr->tree_list, &head);
+		nritems++;
+		i++;
+		curr = __btrfs_next_delayed_item(curr);
+	}
+
+	if (!nritems)
+		return 0;
+
+	ret = btrfs_del_items(trans, root, path, path->slots[0], nritems);
+	if (ret)
+		return ret;
+
+	list_for_each_entry_safe(curr, next, &head, tree_list) {
+		list_del(&curr->tree_list);
+		btrfs_delayed_item_release_metadata(root, curr);
+		btrfs_release_delayed_item(curr);
+	}
+
+	return 0;
+}
+
+static int btrfs_delete_delayed_items(struct btrfs_trans_handle *trans,
+				      struct btrfs_path *path,
+				      struct btrfs_root *root,
+				      struct btrfs_delayed_node *node)
+{
+	struct btrfs_delayed_item *curr;
+	int ret = 0;
+
+	while ((curr = __btrfs_first_delayed_deletion_item(node))) {
+		ret = btrfs_search_slot(trans, root, &curr->key, path, -1, 1);
+		if (ret < 0)
+			break;
+		if (ret > 0) {
+			/* the item is gone already, nothing to delete */
+			btrfs_release_path(root, path);
+			btrfs_delayed_item_release_metadata(root, curr);
+			btrfs_release_delayed_item(curr);
+			ret = 0;
+			continue;
+		}
+
+		ret = btrfs_batch_delete_items(trans, root, path, curr);
+		btrfs_release_path(root, path);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+static int btrfs_update_delayed_inode(struct btrfs_trans_handle *trans,
+				      struct btrfs_root *root,
+				      struct btrfs_path *path,
+				      struct btrfs_delayed_node *node)
+{
+	struct btrfs_key key;
+	struct btrfs_inode_item *inode_item;
+	struct extent_buffer *leaf;
+	int ret;
+
+	if (!node->inode_dirty)
+		return 0;
+
+	key.objectid = node->inode_id;
+	btrfs_set_key_type(&key, BTRFS_INODE_ITEM_KEY);
+	key.offset = 0;
+	ret = btrfs_lookup_inode(trans, root, path, &key, 1);
+	if (ret > 0) {
+		btrfs_release_path(root, path);
+		return -ENOENT;
+	} else if (ret < 0) {
+		return ret;
+	}
+
+	btrfs_unlock_up_safe(path, 1);
+	leaf = path->nodes[0];
+	inode_item = btrfs_item_ptr(leaf, path->slots[0],
+				    struct btrfs_inode_item);
+	write_extent_buffer(leaf, &node->inode_item, (unsigned long)inode_item,
+			    sizeof(struct btrfs_inode_item));
+	btrfs_mark_buffer_dirty(leaf);
+	btrfs_release_path(root, path);
+
+	btrfs_release_delayed_inode(node);
+	return 0;
+}
+
+static int __btrfs_commit_inode_delayed_items(struct btrfs_trans_handle *trans,
+					      struct btrfs_path *path,
+					      struct btrfs_delayed_node *node)
+{
+	struct btrfs_root *root = node->root;
+	int ret;
+
+	mutex_lock(&node->mutex);
+	ret = btrfs_insert_delayed_items(trans, path, root, node);
+	if (!ret)
+		ret = btrfs_delete_delayed_items(trans, path, root, node);
+	if (!ret)
+		ret = btrfs_update_delayed_inode(trans, root, path, node);
+	mutex_unlock(&node->mutex);
+
+	return ret;
+}
+
+/*
+ * write every pending delayed item to the btree, called during
+ * transaction commit
+ */
+int btrfs_run_delayed_items(struct btrfs_trans_handle *trans,
+			    struct btrfs_root *root)
+{
+	struct btrfs_delayed_root *delayed_root;
+	struct btrfs_delayed_node *curr_node, *prev_node;
+	struct btrfs_block_rsv *block_rsv;
+	struct btrfs_path *path;
+	int ret = 0;
+
+	path = btrfs_alloc_path();
+	if (!path)
+		return -ENOMEM;
+	path->leave_spinning = 1;
+
+	block_rsv = trans->block_rsv;
+	trans->block_rsv = &root->fs_info->delayed_block_rsv;
+
+	delayed_root = btrfs_get_delayed_root(root);
+
+	curr_node = btrfs_first_delayed_node(delayed_root);
+	while (curr_node) {
+		ret = __btrfs_commit_inode_delayed_items(trans, path,
+							 curr_node);
+		if (ret) {
+			btrfs_release_delayed_node(curr_node);
+			break;
+		}
+
+		prev_node = curr_node;
+		curr_node = btrfs_next_delayed_node(curr_node);
+		btrfs_release_delayed_node(prev_node);
+	}
+
+	btrfs_free_path(path);
+	trans->block_rsv = block_rsv;
+
+	return ret;
+}
+
+/*
+ * write the pending items of one inode to the btree, for the callers that
+ * are about to read them back from there
+ */
+int btrfs_commit_inode_delayed_items(struct btrfs_trans_handle *trans,
+				     struct inode *inode)
+{
+	struct btrfs_delayed_node *delayed_node;
+	struct btrfs_block_rsv *block_rsv;
+	struct btrfs_path *path;
+	int ret;
+
+	delayed_node = btrfs_get_delayed_node(inode);
+	if (!delayed_node)
+		return 0;
+
+	mutex_lock(&delayed_node->mutex);
+	if (!delayed_node->count) {
+		mutex_unlock(&delayed_node->mutex);
+		btrfs_release_delayed_node(delayed_node);
+		return 0;
+	}
+	mutex_unlock(&delayed_node->mutex);
+
+	path = btrfs_alloc_path();
+	if (!path) {
+		btrfs_release_delayed_node(delayed_node);
+		return -ENOMEM;
+	}
+	path->leave_spinning = 1;
+
+	block_rsv = trans->block_rsv;
+	trans->block_rsv = &delayed_node->root->fs_info->delayed_block_rsv;
+
+	ret = __btrfs_commit_inode_delayed_items(trans, path, delayed_node);
+
+	trans->block_rsv = block_rsv;
+	btrfs_free_path(path);
+	btrfs_release_delayed_node(delayed_node);
+
+	return ret;
+}
+
+struct btrfs_async_delayed_node {
+	struct btrfs_root *root;
+	struct btrfs_delayed_node *delayed_node;
+	struct btrfs_work work;
+};
+
+static void btrfs_async_run_delayed_node_done(struct btrfs_work *work)
+{
+	struct btrfs_async_delayed_node *async_node;
+	struct btrfs_delayed_node *delayed_node;
+	struct btrfs_trans_handle *trans;
+	struct btrfs_block_rsv *block_rsv;
+	struct btrfs_path *path;
+	struct btrfs_root *root;
+
+	async_node = container_of(work, struct btrfs_async_delayed_node, work);
+	delayed_node = async_node->delayed_node;
+	root = delayed_node->root;
+
+	/* a commit may have flushed the node meanwhile */
+	mutex_lock(&delayed_node->mutex);
+	if (!delayed_node->count) {
+		mutex_unlock(&delayed_node->mutex);
+		goto out;
+	}
+	mutex_unlock(&delayed_node->mutex);
+
+	path = btrfs_alloc_path();
+	if (!path)
+		goto out;
+	path->leave_spinning = 1;
+
+	trans = btrfs_join_transaction(root, 0);
+	if (IS_ERR(trans))
+		goto free_path;
+
+	block_rsv = trans->block_rsv;
+	trans->block_rsv = &root->fs_info->delayed_block_rsv;
+
+	/* on failure the items stay queued, the commit retries them */
+	__btrfs_commit_inode_delayed_items(trans, path, delayed_node);
+
+	trans->block_rsv = block_rsv;
+	btrfs_end_transaction(trans, root);
+free_path:
+	btrfs_free_path(path);
+out:
+	btrfs_release_prepared_delayed_node(delayed_node);
+	kfree(async_node);
+}
+
+static int btrfs_wq_run_delayed_node(struct btrfs_delayed_root *delayed_root,
+				     struct btrfs_root *root, int nr)
+{
+	struct btrfs_async_delayed_node *async_node;
+	struct btrfs_delayed_node *curr;
+	int count = 0;
+
+	while (count < nr &&
+	       atomic_read(&delayed_root->items) >= BTRFS_DELAYED_BACKGROUND) {
+		curr = btrfs_first_prepared_delayed_node(delayed_root);
+		if (!curr)
+			break;
+
+		async_node = kmalloc(sizeof(*async_node), GFP_NOFS);
+		if (!async_node) {
+			btrfs_release_prepared_delayed_node(curr);
+			return -ENOMEM;
+		}
+
+		async_node->root = root;
+		async_node->delayed_node = curr;
+		async_node->work.func = btrfs_async_run_delayed_node_done;
+		async_node->work.flags = 0;
+
+		btrfs_queue_worker(&root->fs_info->delayed_workers,
+				   &async_node->work);
+		count++;
+	}
+
+	return 0;
+}
+
+/*
+ * kick the async workers once enough items are pending, and throttle the
+ * caller when they can't keep up.  Must not be called with a transaction
+ * handle held.
+ */
+void btrfs_balance_delayed_items(struct btrfs_root *root)
+{
+	struct btrfs_delayed_root *delayed_root;
+
+	delayed_root = btrfs_get_delayed_root(root);
+
+	if (atomic_read(&delayed_root->items) < BTRFS_DELAYED_BACKGROUND)
+		return;
+
+	if (atomic_read(&delayed_root->items) >= BTRFS_DELAYED_WRITEBACK) {
+		if (btrfs_wq_run_delayed_node(delayed_root, root,
+					      BTRFS_DELAYED_BATCH))
+			return;
+
+		wait_event_interruptible_timeout(delayed_root->wait,
+				(atomic_read(&delayed_root->items) <
+				 BTRFS_DELAYED_BACKGROUND),
+				HZ);
+		return;
+	}
+
+	btrfs_wq_run_delayed_node(delayed_root, root, 4);
+}
+
+/*
+ * queue the insertion of a dir index item.
+ *
+ * Returns 0 if the item was queued, 1 if the caller has to insert it into
+ * the btree itself, or a negative error.
+ */
+int btrfs_insert_delayed_dir_index(struct btrfs_trans_handle *trans,
+				   struct btrfs_root *root, const char *name,
+				   int name_len, struct inode *dir,
+				   struct btrfs_disk_key *disk_key, u8 type,
+				   u64 index)
+{
+	struct btrfs_delayed_node *delayed_node;
+	struct btrfs_delayed_item *delayed_item;
+	struct btrfs_dir_item *dir_item;
+	int ret;
+
+	if (!btrfs_delayed_items_allowed(root))
+		return 1;
+
+	delayed_node = btrfs_get_or_create_delayed_node(dir);
+	if (IS_ERR(delayed_node))
+		return 1;
+
+	delayed_item = btrfs_alloc_delayed_item(sizeof(*dir_item) + name_len);
+	if (!delayed_item) {
+		ret = 1;
+		goto release_node;
+	}
+
+	delayed_item->key.objectid = dir->i_ino;
+	btrfs_set_key_type(&delayed_item->key, BTRFS_DIR_INDEX_KEY);
+	delayed_item->key.offset = index;
+
+	dir_item = (struct btrfs_dir_item *)delayed_item->data;
+	dir_item->location = *disk_key;
+	dir_item->transid = cpu_to_le64(trans->transid);
+	dir_item->data_len = 0;
+	dir_item->name_len = cpu_to_le16(name_len);
+	dir_item->type = type;
+	memcpy((char *)(dir_item + 1), name, name_len);
+
+	ret = btrfs_delayed_reserve_metadata(trans, root,
+					     &delayed_item->bytes_reserved);
+	if (ret) {
+		kfree(delayed_item);
+		ret = 1;
+		goto release_node;
+	}
+
+	mutex_lock(&delayed_node->mutex);
+	ret = __btrfs_add_delayed_item(delayed_node, delayed_item,
+				       BTRFS_DELAYED_INSERTION_ITEM);
+	if (ret) {
+		printk(KERN_ERR "btrfs: dir index %llu of inode %llu in root "
+		       "%llu is already queued for insertion\n",
+		       (unsigned long long)index,
+		       (unsigned long long)delayed_node->inode_id,
+		       (unsigned long long)root->root_key.objectid);
+		btrfs_delayed_item_release_metadata(root, delayed_item);
+		kfree(delayed_item);
+	}
+	mutex_unlock(&delayed_node->mutex);
+
+release_node:
+	__btrfs_release_delayed_node(delayed_node, 1);
+	return ret;
+}
+
+/*
+ * queue the deletion of a dir index item.  An index that is still waiting
+ * to be inserted is simply dropped.
+ *
+ * Returns 0 if the deletion was queued, 1 if the caller has to delete the
+ * item from the btree itself, or a negative error.
+ */
+int btrfs_delete_delayed_dir_index(struct btrfs_trans_handle *trans,
+				   struct btrfs_root *root, struct inode *dir,
+				   u64 index)
+{
+	struct btrfs_delayed_node *node;
+	struct btrfs_delayed_item *item;
+	struct btrfs_key item_key;
+	int ret;
+
+	if (!btrfs_delayed_items_allowed(root))
+		return 1;
+
+	node = btrfs_get_or_create_delayed_node(dir);
+	if (IS_ERR(node))
+		return 1;
+
+	item_key.objectid = dir->i_ino;
+	btrfs_set_key_type(&item_key, BTRFS_DIR_INDEX_KEY);
+	item_key.offset = index;
+
+	mutex_lock(&node->mutex);
+	item = __btrfs_lookup_delayed_item(&node->ins_root, &item_key);
+	if (item) {
+		/* it never made it to the btree */
+		btrfs_delayed_item_release_metadata(root, item);
+		btrfs_release_delayed_item(item);
+		ret = 0;
+		goto unlock;
+	}
+
+	item = btrfs_alloc_delayed_item(0);
+	if (!item) {
+		ret = 1;
+		goto unlock;
+	}
+	item->key = item_key;
+
+	ret = btrfs_delayed_reserve_metadata(trans, root,
+					     &item->bytes_reserved);
+	if (ret) {
+		kfree(item);
+		ret = 1;
+		goto unlock;
+	}
+
+	ret = __btrfs_add_delayed_item(node, item,
+				       BTRFS_DELAYED_DELETION_ITEM);
+	if (ret) {
+		printk(KERN_ERR "btrfs: dir index %llu of inode %llu in root "
+		       "%llu is already queued for deletion\n",
+		       (unsigned long long)index,
+		       (unsigned long long)node->inode_id,
+		       (unsigned long long)root->root_key.objectid);
+		btrfs_delayed_item_release_metadata(root, item);
+		kfree(item);
+	}
+unlock:
+	mutex_unlock(&node->mutex);
+	__btrfs_release_delayed_node(node, 1);
+	return ret;
+}
+
+/*
+ * dir indexes queued for insertion aren't in the btree yet, make sure the
+ * index counter of the directory doesn't hand them out again
+ */
+int btrfs_inode_delayed_dir_index_count(struct inode *inode)
+{
+	struct btrfs_delayed_node *delayed_node;
+
+	delayed_node = btrfs_get_delayed_node(inode);
+	if (!delayed_node)
+		return -ENOENT;
+
+	mutex_lock(&delayed_node->mutex);
+	if (delayed_node->index_cnt > BTRFS_I(inode)->index_cnt)
+		BTRFS_I(inode)->index_cnt = delayed_node->index_cnt;
+	mutex_unlock(&delayed_node->mutex);
+
+	btrfs_release_delayed_node(delayed_node);
+	return 0;
+}
+
+void btrfs_get_delayed_items(struct inode *inode, struct list_head *ins_list,
+			     struct list_head *del_list)
+{
+	struct btrfs_delayed_node *delayed_node;
+	struct btrfs_delayed_item *item;
+
+	delayed_node = btrfs_get_delayed_node(inode);
+	if (!delayed_node)
+		return;
+
+	mutex_lock(&delayed_node->mutex);
+	item = __btrfs_first_delayed_insertion_item(delayed_node);
+	while (item) {
+		atomic_inc(&item->refs);
+		list_add_tail(&item->readdir_list, ins_list);
+		item = __btrfs_next_delayed_item(item);
+	}
+
+	item = __btrfs_first_delayed_deletion_item(delayed_node);
+	while (item) {
+		atomic_inc(&item->refs);
+		list_add_tail(&item->readdir_list, del_list);
+		item = __btrfs_next_delayed_item(item);
+	}
+	mutex_unlock(&delayed_node->mutex);
+
+	btrfs_release_delayed_node(delayed_node);
+}
+
+void btrfs_put_delayed_items(struct list_head *ins_list,
+			     struct list_head *del_list)
+{
+	struct btrfs_delayed_item *curr, *next;
+
+	list_for_each_entry_safe(curr, next, ins_list, readdir_list) {
+		list_del(&curr->readdir_list);
+		if (atomic_dec_and_test(&curr->refs))
+			kfree(curr);
+	}
+
+	list_for_each_entry_safe(curr, next, del_list, readdir_list) {
+		list_del(&curr->readdir_list);
+		if (atomic_dec_and_test(&curr->refs))
+			kfree(curr);
+	}
+}
+
+/*
+ * readdir walks the btree in index order, so the deletion items with a
+ * lower index than the current one can be dropped as we go
+ */
+int btrfs_should_delete_dir_index(struct list_head *del_list, u64 index)
+{
+	struct btrfs_delayed_item *curr, *next;
+	int ret = 0;
+
+	list_for_each_entry_safe(curr, next, del_list, readdir_list) {
+		if (curr->key.offset > index)
+			break;
+
+		list_del(&curr->readdir_list);
+		ret = (curr->key.offset == index);
+
+		if (atomic_dec_and_test(&curr->refs))
+			kfree(curr);
+
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+/*
+ * emit the dir indexes that are queued for insertion.  They are newer than
+ * anything in the btree, except for items flushed after readdir grabbed
+ * the list: those were already returned from the btree, up to last_index.
+ *
+ * Returns 1 if filldir ran out of space.
+ */
+int btrfs_readdir_delayed_dir_index(struct file *filp, void *dirent,
+				    filldir_t filldir,
+				    struct list_head *ins_list,
+				    u64 last_index)
+{
+	struct inode *inode = filp->f_dentry->d_inode;
+	struct btrfs_root *root = BTRFS_I(inode)->root;
+	struct btrfs_dir_item *di;
+	struct btrfs_delayed_item *curr, *next;
+	struct btrfs_key location;
+	char *name;
+	int name_len;
+	int over = 0;
+	unsigned char d_type;
+
+	/*
+	 * the data of a delayed item never changes and we hold i_mutex of
+	 * the directory, so nobody can add or remove indexes meanwhile
+	 */
+	list_for_each_entry_safe(curr, next, ins_list, readdir_list) {
+		list_del(&curr->readdir_list);
+
+		if (curr->key.offset < filp->f_pos ||
+		    curr->key.offset <= last_index)
+			goto next;
+
+		filp->f_pos = curr->key.offset;
+
+		di = (struct btrfs_dir_item *)curr->data;
+		name = (char *)(di + 1);
+		name_len = le16_to_cpu(di->name_len);
+
+		d_type = btrfs_filetype_table[di->type];
+		btrfs_disk_key_to_cpu(&location, &di->location);
+
+		/* is this a reference to our own snapshot? If so skip it */
+		if (location.type == BTRFS_ROOT_ITEM_KEY &&
+		    location.objectid == root->root_key.objectid)
+			goto next;
+
+		over = filldir(dirent, name, name_len, curr->key.offset,
+			       location.objectid, d_type);
+next:
+		if (atomic_dec_and_test(&curr->refs))
+			kfree(curr);
+
+		if (over)
+			return 1;
+	}
+	return 0;
+}
+
+static void fill_stack_inode_item(struct btrfs_trans_handle *trans,
+				  struct btrfs_inode_item *inode_item,
+				  struct inode *inode)
+{
+	btrfs_set_stack_inode_uid(inode_item, inode->i_uid);
+	btrfs_set_stack_inode_gid(inode_item, inode->i_gid);
+	btrfs_set_stack_inode_size(inode_item, BTRFS_I(inode)->disk_i_size);
+	btrfs_set_stack_inode_mode(inode_item, inode->i_mode);
+	btrfs_set_stack_inode_nlink(inode_item, inode->i_nlink);
+	btrfs_set_stack_inode_nbytes(inode_item, inode_get_bytes(inode));
+	btrfs_set_stack_inode_generation(inode_item,
+					 BTRFS_I(inode)->generation);
+	btrfs_set_stack_inode_sequence(inode_item, BTRFS_I(inode)->sequence);
+	btrfs_set_stack_inode_transid(inode_item, trans->transid);
+	btrfs_set_stack_inode_rdev(inode_item, inode->i_rdev);
+	btrfs_set_stack_inode_flags(inode_item, BTRFS_I(inode)->flags);
+	btrfs_set_stack_inode_block_group(inode_item,
+					  BTRFS_I(inode)->block_group);
+
+	btrfs_set_stack_timespec_sec(btrfs_inode_atime(inode_item),
+				     inode->i_atime.tv_sec);
+	btrfs_set_stack_timespec_nsec(btrfs_inode_atime(inode_item),
+				      inode->i_atime.tv_nsec);
+
+	btrfs_set_stack_timespec_sec(btrfs_inode_mtime(inode_item),
+				     inode->i_mtime.tv_sec);
+	btrfs_set_stack_timespec_nsec(btrfs_inode_mtime(inode_item),
+				      inode->i_mtime.tv_nsec);
+
+	btrfs_set_stack_timespec_sec(btrfs_inode_ctime(inode_item),
+				     inode->i_ctime.tv_sec);
+	btrfs_set_stack_timespec_nsec(btrfs_inode_ctime(inode_item),
+				      inode->i_ctime.tv_nsec);
+}
+
+/*
+ * read an inode whose latest inode item is still in its delayed node,
+ * returns -ENOENT if the btree copy is current
+ */
+int btrfs_fill_inode(struct inode *inode, u32 *rdev)
+{
+	struct btrfs_delayed_node *delayed_node;
+	struct btrfs_inode_item *inode_item;
+	struct btrfs_timespec *tspec;
+	u64 alloc_group_block;
+
+	delayed_node = btrfs_get_delayed_node(inode);
+	if (!delayed_node)
+		return -ENOENT;
+
+	mutex_lock(&delayed_node->mutex);
+	if (!delayed_node->inode_dirty) {
+		mutex_unlock(&delayed_node->mutex);
+		btrfs_release_delayed_node(delayed_node);
+		return -ENOENT;
+	}
+
+	inode_item = &delayed_node->inode_item;
+
+	inode->i_uid = btrfs_stack_inode_uid(inode_item);
+	inode->i_gid = btrfs_stack_inode_gid(inode_item);
+	btrfs_i_size_write(inode, btrfs_stack_inode_size(inode_item));
+	inode->i_mode = btrfs_stack_inode_mode(inode_item);
+	inode->i_nlink = btrfs_stack_inode_nlink(inode_item);
+	inode_set_bytes(inode, btrfs_stack_inode_nbytes(inode_item));
+	BTRFS_I(inode)->generation = btrfs_stack_inode_generation(inode_item);
+	BTRFS_I(inode)->sequence = btrfs_stack_inode_sequence(inode_item);
+	inode->i_generation = BTRFS_I(inode)->generation;
+	inode->i_rdev = 0;
+	*rdev = btrfs_stack_inode_rdev(inode_item);
+	BTRFS_I(inode)->flags = btrfs_stack_inode_flags(inode_item);
+	alloc_group_block = btrfs_stack_inode_block_group(inode_item);
+
+	tspec = btrfs_inode_atime(inode_item);
+	inode->i_atime.tv_sec = btrfs_stack_timespec_sec(tspec);
+	inode->i_atime.tv_nsec = btrfs_stack_timespec_nsec(tspec);
+
+	tspec = btrfs_inode_mtime(inode_item);
+	inode->i_mtime.tv_sec = btrfs_stack_timespec_sec(tspec);
+	inode->i_mtime.tv_nsec = btrfs_stack_timespec_nsec(tspec);
+
+	tspec = btrfs_inode_ctime(inode_item);
+	inode->i_ctime.tv_sec = btrfs_stack_timespec_sec(tspec);
+	inode->i_ctime.tv_nsec = btrfs_stack_timespec_nsec(tspec);
+
+	BTRFS_I(inode)->index_cnt = (u64)-1;
+	mutex_unlock(&delayed_node->mutex);
+
+	BTRFS_I(inode)->block_group = btrfs_find_block_group(BTRFS_I(inode)->root,
+						0, alloc_group_block, 0);
+	btrfs_release_delayed_node(delayed_node);
+	return 0;
+}
+
+/*
+ * queue an update of the inode item.
+ *
+ * Returns 0 if the update was queued, 1 if the caller has to update the
+ * btree itself, or a negative error.
+ */
+int btrfs_delayed_update_inode(struct btrfs_trans_handle *trans,
+			       struct btrfs_root *root, struct inode *inode)
+{
+	struct btrfs_delayed_node *delayed_node;
+	int ret = 0;
+
+	if (!btrfs_delayed_items_allowed(root))
+		return 1;
+
+	delayed_node = btrfs_get_or_create_delayed_node(inode);
+	if (IS_ERR(delayed_node))
+		return 1;
+
+	mutex_lock(&delayed_node->mutex);
+	if (!delayed_node->inode_dirty) {
+		/*
+		 * no older copy is queued, so if there is no space to
+		 * queue this one the btree can be updated right away
+		 */
+		ret = btrfs_delayed_reserve_metadata(trans, root,
+					&delayed_node->bytes_reserved);
+		if (ret) {
+			ret = 1;
+			goto release_node;
+		}
+
+		delayed_node->inode_dirty = true;
+		delayed_node->count++;
+		atomic_inc(&root->fs_info->delayed_root->items);
+	}
+
+	fill_stack_inode_item(trans, &delayed_node->inode_item, inode);
+release_node:
+	mutex_unlock(&delayed_node->mutex);
+	__btrfs_release_delayed_node(delayed_node, 1);
+	return ret;
+}
+
+static void __btrfs_kill_delayed_node(struct btrfs_delayed_node *delayed_node)
+{
+	struct btrfs_root *root = delayed_node->root;
+	struct btrfs_delayed_item *curr_item, *prev_item;
+
+	mutex_lock(&delayed_node->mutex);
+	curr_item = __btrfs_first_delayed_insertion_item(delayed_node);
+	while (curr_item) {
+		btrfs_delayed_item_release_metadata(root, curr_item);
+		prev_item = curr_item;
+		curr_item = __btrfs_next_delayed_item(prev_item);
+		btrfs_release_delayed_item(prev_item);
+	}
+
+	curr_item = __btrfs_first_delayed_deletion_item(delayed_node);
+	while (curr_item) {
+		btrfs_delayed_item_release_metadata(root, curr_item);
+		prev_item = curr_item;
+		curr_item = __btrfs_next_delayed_item(prev_item);
+		btrfs_release_delayed_item(prev_item);
+	}
+
+	btrfs_release_delayed_inode(delayed_node);
+	mutex_unlock(&delayed_node->mutex);
+}
+
+/*
+ * the inode is being deleted, its items go away with it and nothing that
+ * is queued for it has to reach the btree
+ */
+void btrfs_kill_delayed_inode_items(struct inode *inode)
+{
+	struct btrfs_delayed_node *delayed_node;
+
+	delayed_node = btrfs_get_delayed_node(inode);
+	if (!delayed_node)
+		return;
+
+	__btrfs_kill_delayed_node(delayed_node);
+	btrfs_release_delayed_node(delayed_node);
+}
+
+/* drop the reference the in-memory inode holds on its delayed node */
+void btrfs_remove_delayed_node(struct inode *inode)
+{
+	struct btrfs_delayed_node *delayed_node;
+
+	delayed_node = ACCESS_ONCE(BTRFS_I(inode)->delayed_node);
+	if (!delayed_node)
+		return;
+
+	BTRFS_I(inode)->delayed_node = NULL;
+	btrfs_release_delayed_node(delayed_node);
+}
+
+/* the root is going away, drop whatever is still queued for it */
+void btrfs_kill_all_delayed_nodes(struct btrfs_root *root)
+{
+	struct btrfs_delayed_node *delayed_nodes[8];
+	unsigned long index = 0;
+	int i, n;
+
+	while (1) {
+		spin_lock(&root->inode_lock);
+		n = radix_tree_gang_lookup(&root->delayed_nodes_tree,
+					   (void **)delayed_nodes, index,
+					   ARRAY_SIZE(delayed_nodes));
+		if (!n) {
+			spin_unlock(&root->inode_lock);
+			break;
+		}
+
+		index = delayed_nodes[n - 1]->inode_id + 1;
+
+		for (i = 0; i < n; i++)
+			atomic_inc(&delayed_nodes[i]->refs);
+		spin_unlock(&root->inode_lock);
+
+		for (i = 0; i < n; i++) {
+			__btrfs_kill_delayed_node(delayed_nodes[i]);
+			btrfs_release_delayed_node(delayed_nodes[i]);
+		}
+	}
+}
@@ -27,6 +27,7 @@ struct extent_map {
 	struct block_device *bdev;
 	atomic_t refs;
 	int in_tree;
+	int compress_type;
 };
 
 struct extent_map_tree {
@@ -26,7 +26,8 @@
  */
 
 /*
- * Calculate the block group number and offset, given a block number
+ * Calculate the block group number and offset into the block/cluster
+ * allocation bitmap, given a block number
  */
 void ext4_get_group_no_and_offset(struct super_block *sb, ext4_fsblk_t blocknr,
 		ext4_group_t *blockgrpp, ext4_grpblk_t *offsetp)
@@ -35,7 +36,8 @@ void ext4_get_group_no_and_offset(struct super_block *sb, ext4_fsblk_t blocknr,
 	ext4_grpblk_t offset;
 
 	blocknr = blocknr - le32_to_cpu(es->s_first_data_block);
-	offset = do_div(blocknr, EXT4_BLOCKS_PER_GROUP(sb));
+	offset = do_div(blocknr, EXT4_BLOCKS_PER_GROUP(sb)) >>
+		EXT4_SB(sb)->s_cluster_bits;
 	if (offsetp)
 		*offsetp = offset;
 	if (blockgrpp)
@@ -53,42 +55,103 @@ static int ext4_block_in_group(struct super_block *sb, ext4_fsblk_t block,
 	return 0;
 }
 
-static int ext4_group_used_meta_blocks(struct super_block *sb,
-				       ext4_group_t block_group,
-				       struct ext4_group_desc *gdp)
+/*
+ * Number of blocks at the start of the group used by the superblock and
+ * group descriptor backups
+ */
+static unsigned ext4_num_base_meta_blocks(struct super_block *sb,
+					  ext4_group_t block_group)
 {
-	ext4_fsblk_t tmp;
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
-	/* block bitmap, inode bitmap, and inode table blocks */
-	int used_blocks = sbi->s_itb_per_group + 2;
+	unsigned num;
 
-	if (EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_FLEX_BG)) {
-		if (!ext4_block_in_group(sb, ext4_block_bitmap(sb, gdp),
-					block_group))
-			used_blocks--;
+	/* Check for superblock and gdt backups in this group */
+	num = ext4_bg_has_super(sb, block_group);
 
-		if (!ext4_block_in_group(sb, ext4_inode_bitmap(sb, gdp),
-					block_group))
-			used_blocks--;
+	if (!EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_META_BG) ||
+	    block_group < le32_to_cpu(sbi->s_es->s_first_meta_bg) *
+			  sbi->s_desc_per_block) {
+		if (num) {
+			num += ext4_bg_num_gdb(sb, block_group);
+			num += le16_to_cpu(sbi->s_es->s_reserved_gdt_blocks);
+		}
+	} else { /* For META_BG_BLOCK_GROUPS */
+		num += ext4_bg_num_gdb(sb, block_group);
+	}
+	return num;
+}
 
-		tmp = ext4_inode_table(sb, gdp);
-		for (; tmp < ext4_inode_table(sb, gdp) +
-				sbi->s_itb_per_group; tmp++) {
-			if (!ext4_block_in_group(sb, tmp, block_group))
-				used_blocks -= 1;
+/*
+ * Count the clusters of the group holding its superblock and group
+ * descriptor backups, its bitmaps and its inode table.  With bigalloc
+ * several of these may share a cluster, so the (at most four) cluster
+ * ranges are merged before they are counted.
+ */
+static unsigned ext4_num_overhead_clusters(struct super_block *sb,
+					   ext4_group_t block_group,
+					   struct ext4_group_desc *gdp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_fsblk_t start = ext4_group_first_block_no(sb, block_group);
+	ext4_fsblk_t end = start + EXT4_BLOCKS_PER_GROUP(sb);
+	ext4_fsblk_t first[4], last[4], tmp;
+	unsigned num_clusters = 0;
+	int i, j, n = 0;
+
+	tmp = ext4_num_base_meta_blocks(sb, block_group);
+	if (tmp) {
+		first[n] = start;
+		last[n++] = start + tmp - 1;
+	}
+	first[n] = last[n] = ext4_block_bitmap(sb, gdp);
+	n++;
+	first[n] = last[n] = ext4_inode_bitmap(sb, gdp);
+	n++;
+	first[n] = ext4_inode_table(sb, gdp);
+	last[n] = first[n] + sbi->s_itb_per_group - 1;
+	n++;
+
+	/* clip to the group, turn into clusters and sort by start */
+	for (i = 0, j = 0; i < n; i++) {
+		ext4_fsblk_t f = max(first[i], start);
+		ext4_fsblk_t l = min(last[i], end - 1);
+		int k;
+
+		if (f > l)
+			continue;
+		f = EXT4_B2C(sbi, f);
+		l = EXT4_B2C(sbi, l);
+		for (k = j; k > 0 && first[k - 1] > f; k--) {
+			first[k] = first[k - 1];
+			last[k] = last[k - 1];
 		}
+		first[k] = f;
+		last[k] = l;
+		j++;
 	}
-	return used_blocks;
+
+	for (i = 0, tmp = 0; i < j; i++) {
+		if (num_clusters && first[i] <= tmp) {
+			if (last[i] > tmp) {
+				num_clusters += last[i] - tmp;
+				tmp = last[i];
+			}
+			continue;
+		}
+		num_clusters += last[i] - first[i] + 1;
+		tmp = last[i];
+	}
+	return num_clusters;
 }
 
 /* Initializes an uninitialized block bitmap if given, and returns the
- * number of blocks free in the group. */
+ * number of clusters free in the group. */
 unsigned ext4_init_block_bitmap(struct super_block *sb, struct buffer_head *bh,
 		 ext4_group_t block_group, struct ext4_group_desc *gdp)
 {
 	int bit, bit_max;
 	ext4_group_t ngroups = ext4_get_groups_count(sb);
-	unsigned free_blocks, group_blocks;
+	unsigned group_clusters;
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
 
 	if (bh) {
@@ -108,39 +171,26 @@ unsigned ext4_init_block_bitmap(struct super_block *sb, struct buffer_head *bh,
 		memset(bh->b_data, 0, sb->s_blocksize);
 	}
 
-	/* Check for superblock and gdt backups in this group */
-	bit_max = ext4_bg_has_super(sb, block_group);
-
-	if (!EXT4_HAS_INCOMPAT_FEATURE(sb, EXT4_FEATURE_INCOMPAT_META_BG) ||
-	    block_group < le32_to_cpu(sbi->s_es->s_first_meta_bg) *
-			  sbi->s_desc_per_block) {
-		if (bit_max) {
-			bit_max += ext4_bg_num_gdb(sb, block_group);
-			bit_max +=
-				le16_to_cpu(sbi->s_es->s_reserved_gdt_blocks);
-		}
-	} else { /* For META_BG_BLOCK_GROUPS */
-		bit_max += ext4_bg_num_gdb(sb, block_group);
-	}
-
 	if (block_group == ngroups - 1) {
 		/*
 		 * Even though mke2fs always initialize first and last group
 		 * if some other tool enabled the EXT4_BG_BLOCK_UNINIT we need
-		 * to make sure we calculate the right free blocks
+		 * to make sure we calculate the right free blocks.  A partial
+		 * cluster at the end of the filesystem is never allocated.
 		 */
-		group_blocks = ext4_blocks_count(sbi->s_es) -
-			ext4_group_first_block_no(sb, ngroups - 1);
+		group_clusters = EXT4_B2C(sbi, ext4_blocks_count(sbi->s_es) -
+			ext4_group_first_block_no(sb, ngroups - 1));
 	} else {
-		group_blocks = EXT4_BLOCKS_PER_GROUP(sb);
+		group_clusters = EXT4_CLUSTERS_PER_GROUP(sb);
 	}
 
-	free_blocks = group_blocks - bit_max;
-
 	if (bh) {
 		ext4_fsblk_t start, tmp;
 		int flex_bg = 0;
 
+		bit_max = ext4_num_base_meta_blocks(sb, block_group);
+		if (bit_max)
+			bit_max = EXT4_NUM_B2C(sbi, bit_max);
 		for (bit = 0; bit < bit_max; bit++)
 			ext4_set_bit(bit, bh->b_data);
 
@@ -153,28 +203,30 @@ unsigned ext4_init_block_bitmap(struct super_block *sb, struct buffer_head *bh,
 		/* Set bits for block and inode bitmaps, and inode table */
 		tmp = ext4_block_bitmap(sb, gdp);
 		if (!flex_bg || ext4_block_in_group(sb, tmp, block_group))
-			ext4_set_bit(tmp - start, bh->b_data);
+			ext4_set_bit(EXT4_B2C(sbi, tmp - start), bh->b_data);
 
 		tmp = ext4_inode_bitmap(sb, gdp);
 		if (!flex_bg || ext4_block_in_group(sb, tmp, block_group))
-			ext4_set_bit(tmp - start, bh->b_data);
+			ext4_set_bit(EXT4_B2C(sbi, tmp - start), bh->b_data);
 
 		tmp = ext4_inode_table(sb, gdp);
 		for (; tmp < ext4_inode_table(sb, gdp) +
 				sbi->s_itb_per_group; tmp++) {
 			if (!flex_bg ||
 				ext4_block_in_group(sb, tmp, block_group))
-				ext4_set_bit(tmp - start, bh->b_data);
+				ext4_set_bit(EXT4_B2C(sbi, tmp - start),
+					     bh->b_data);
 		}
 		/*
-		 * Also if the number of blocks within the group is
+		 * Also if the number of clusters within the group is
 		 * less than the blocksize * 8 ( which is the size
 		 * of bitmap ), set rest of the block bitmap to 1
 		 */
-		ext4_mark_bitmap_end(group_blocks, sb->s_blocksize * 8,
+		ext4_mark_bitmap_end(group_clusters, sb->s_blocksize * 8,
 				     bh->b_data);
 	}
-	return free_blocks - ext4_group_used_meta_blocks(sb, block_group, gdp);
+	return group_clusters -
+		ext4_num_overhead_clusters(sb, block_group, gdp);
 }
 
 
@@ -235,7 +287,8 @@ static int ext4_valid_block_bitmap(struct super_block *sb,
 					unsigned int block_group,
 					struct buffer_head *bh)
 {
-	ext4_grpblk_t offset;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_grpblk_t offset, end;
 	ext4_grpblk_t next_zero_bit;
 	ext4_fsblk_t bitmap_blk;
 	ext4_fsblk_t group_first_block;
@@ -253,25 +306,25 @@ static int ext4_valid_block_bitmap(struct super_block *sb,
 
 	/* check whether block bitmap block number is set */
 	bitmap_blk = ext4_block_bitmap(sb, desc);
-	offset = bitmap_blk - group_first_block;
+	offset = EXT4_B2C(sbi, bitmap_blk - group_first_block);
 	if (!ext4_test_bit(offset, bh->b_data))
 		/* bad block bitmap */
 		goto err_out;
 
 	/* check whether the inode bitmap block number is set */
 	bitmap_blk = ext4_inode_bitmap(sb, desc);
-	offset = bitmap_blk - group_first_block;
+	offset = EXT4_B2C(sbi, bitmap_blk - group_first_block);
 	if (!ext4_test_bit(offset, bh->b_data))
 		/* bad block bitmap */
 		goto err_out;
 
 	/* check whether the inode table block number is set */
 	bitmap_blk = ext4_inode_table(sb, desc);
-	offset = bitmap_blk - group_first_block;
-	next_zero_bit = ext4_find_next_zero_bit(bh->b_data,
-				offset + EXT4_SB(sb)->s_itb_per_group,
-				offset);
-	if (next_zero_bit >= offset + EXT4_SB(sb)->s_itb_per_group)
+	offset = EXT4_B2C(sbi, bitmap_blk - group_first_block);
+	end = EXT4_B2C(sbi, bitmap_blk + sbi->s_itb_per_group - 1 -
+		       group_first_block) + 1;
+	next_zero_bit = ext4_find_next_zero_bit(bh->b_data, end, offset);
+	if (next_zero_bit >= end)
 		/* good bitmap for inode tables */
 		return 1;
 
@@ -485,10 +538,10 @@ error_return:
 /**
  * ext4_has_free_blocks()
  * @sbi:	in-core super block structure.
- * @nblocks:	number of needed blocks
+ * @nblocks:	number of needed clusters
  *
- * Check if filesystem has nblocks free & available for allocation.
- * On success return 1, return 0 on failure.
+ * Check if filesystem has nblocks clusters free & available for
+ * allocation.  On success return 1, return 0 on failure.
  */
 static int ext4_has_free_blocks(struct ext4_sb_info *sbi, s64 nblocks)
 {
@@ -498,7 +551,7 @@ static int ext4_has_free_blocks(struct ext4_sb_info *sbi, s64 nblocks)
 
 	free_blocks  = percpu_counter_read_positive(fbc);
 	dirty_blocks = percpu_counter_read_positive(dbc);
-	root_blocks = ext4_r_blocks_count(sbi->s_es);
+	root_blocks = EXT4_NUM_B2C(sbi, ext4_r_blocks_count(sbi->s_es));
 
 	if (free_blocks - (nblocks + root_blocks + dirty_blocks) <
 						EXT4_FREEBLOCKS_WATERMARK) {
@@ -602,10 +655,10 @@ ext4_fsblk_t ext4_new_meta_blocks(handle_t *handle, struct inode *inode,
 }
 
 /**
- * ext4_count_free_blocks() -- count filesystem free blocks
+ * ext4_count_free_blocks() -- count filesystem free clusters
  * @sb:		superblock
  *
- * Adds up the number of free blocks from each block group.
+ * Adds up the number of free clusters from each block group.
  */
 ext4_fsblk_t ext4_count_free_blocks(struct super_block *sb)
 {
@@ -43,6 +43,7 @@
 #include <linux/fiemap.h>
 #include "ext4_jbd2.h"
 #include "ext4_extents.h"
+#include "xattr.h"
 
 static int ext4_ext_truncate_extend_restart(handle_t *handle,
 					    struct inode *inode,
@@ -2015,14 +2016,17 @@ errout:
 /*
  * ext4_ext_rm_idx:
  * removes index from the index block.
- * It's used in truncate case only, thus all requests are for
- * last index in the block only.
+ * Truncate always removes the last index in the block, hole punching
+ * may remove one from the middle or the start, in which case the keys
+ * of the indexes above have to be corrected.  @depth is the level of
+ * the freed block in @path.
  */
 static int ext4_ext_rm_idx(handle_t *handle, struct inode *inode,
-			struct ext4_ext_path *path)
+			struct ext4_ext_path *path, int depth)
 {
 	int err;
 	ext4_fsblk_t leaf;
+	__le32 border;
 
 	/* free index block */
 	path--;
@@ -2034,6 +2038,11 @@ static int ext4_ext_rm_idx(handle_t *handle, struct inode *inode,
 	err = ext4_ext_get_access(handle, inode, path);
 	if (err)
 		return err;
+	if (path->p_idx != EXT_LAST_INDEX(path->p_hdr)) {
+		int len = EXT_LAST_INDEX(path->p_hdr) - path->p_idx;
+		len *= sizeof(struct ext4_extent_idx);
+		memmove(path->p_idx, path->p_idx + 1, len);
+	}
 	le16_add_cpu(&path->p_hdr->eh_entries, -1);
 	err = ext4_ext_dirty(handle, inode, path);
 	if (err)
@@ -2041,6 +2050,20 @@ static int ext4_ext_rm_idx(handle_t *handle, struct inode *inode,
 	ext_debug("index is empty, remove it, free block %llu\n", leaf);
 	ext4_free_blocks(handle, inode, 0, leaf, 1,
 			 EXT4_FREE_BLOCKS_METADATA | EXT4_FREE_BLOCKS_FORGET);
+
+	/* the first index changed, propagate its key upwards */
+	while (--depth > 0 && path->p_hdr->eh_entries &&
+	       path->p_idx == EXT_FIRST_INDEX(path->p_hdr)) {
+		border = path->p_idx->ei_block;
+		path--;
+		err = ext4_ext_get_access(handle, inode, path);
+		if (err)
+			break;
+		path->p_idx->ei_block = border;
+		err = ext4_ext_dirty(handle, inode, path);
+		if (err)
+			break;
+	}
 	return err;
 }
 
@@ -2103,15 +2126,69 @@ int ext4_ext_index_trans_blocks(struct inode *inode, int nrblocks, int chunk)
 	return index;
 }
 
+/*
+ * ext4_ext_range_mapped:
+ * returns 1 if any of the blocks @from to @to is mapped by an extent,
+ * 0 if none is, or a negative error code.
+ */
+static int ext4_ext_range_mapped(struct inode *inode, ext4_lblk_t from,
+				 ext4_lblk_t to)
+{
+	struct ext4_ext_path *path;
+	struct ext4_extent *ex;
+	int ret = 0;
+
+	path = ext4_ext_find_extent(inode, to, NULL);
+	if (IS_ERR(path))
+		return PTR_ERR(path);
+
+	ex = path[ext_depth(inode)].p_ext;
+	if (ex && le32_to_cpu(ex->ee_block) <= to &&
+	    le32_to_cpu(ex->ee_block) + ext4_ext_get_actual_len(ex) > from)
+		ret = 1;
+
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	return ret;
+}
+
 static int ext4_remove_blocks(handle_t *handle, struct inode *inode,
 				struct ext4_extent *ex,
 				ext4_lblk_t from, ext4_lblk_t to)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	unsigned short ee_len =  ext4_ext_get_actual_len(ex);
 	int flags = EXT4_FREE_BLOCKS_FORGET;
+	int ret;
 
 	if (S_ISDIR(inode->i_mode) || S_ISLNK(inode->i_mode))
 		flags |= EXT4_FREE_BLOCKS_METADATA;
+
+	/*
+	 * With bigalloc, the clusters at either end of the range may
+	 * still back blocks outside of it: leave those allocated.  The
+	 * extents are removed right to left, so whoever drops the last
+	 * reference to a shared cluster frees it.
+	 */
+	if (sbi->s_cluster_ratio > 1) {
+		if (EXT4_LBLK_COFF(sbi, from)) {
+			ret = ext4_ext_range_mapped(inode,
+					EXT4_LBLK_CMASK(sbi, from), from - 1);
+			if (ret < 0)
+				return ret;
+			if (ret)
+				flags |= EXT4_FREE_BLOCKS_NOFREE_FIRST_CLUSTER;
+		}
+		if (EXT4_LBLK_COFF(sbi, to + 1)) {
+			ret = ext4_ext_range_mapped(inode, to + 1,
+					EXT4_LBLK_CMASK(sbi, to) +
+					sbi->s_cluster_ratio - 1);
+			if (ret < 0)
+				return ret;
+			if (ret)
+				flags |= EXT4_FREE_BLOCKS_NOFREE_LAST_CLUSTER;
+		}
+	}
 #ifdef EXTENTS_STATS
 	{
 		struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
@@ -2275,7 +2352,7 @@ ext4_ext_rm_leaf(handle_t *handle, struct inode *inode,
 	/* if this leaf is free, then we should
 	 * remove it from index block above */
 	if (err == 0 && eh->eh_entries == 0 && path[depth].p_bh != NULL)
-		err = ext4_ext_rm_idx(handle, inode, path + depth);
+		err = ext4_ext_rm_idx(handle, inode, path + depth, depth);
 
 out:
 	return err;
@@ -2403,7 +2480,7 @@ again:
 				/* index is empty, remove it;
 				 * handle must be already prepared by the
 				 * truncatei_leaf() */
-				err = ext4_ext_rm_idx(handle, inode, path + i);
+				err = ext4_ext_rm_idx(handle, inode, path + i, i);
 			}
 			/* root level has p_bh == NULL, brelse() eats this */
 			brelse(path[i].p_bh);
@@ -3275,9 +3352,11 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 	struct ext4_ext_path *path = NULL;
 	struct ext4_extent_header *eh;
 	struct ext4_extent newex, *ex;
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	ext4_fsblk_t newblock;
 	int err = 0, depth, ret, cache_type;
-	unsigned int allocated = 0;
+	unsigned int allocated = 0, offset = 0;
+	unsigned int allocated_clusters = 0;
 	struct ext4_allocation_request ar;
 	ext4_io_end_t *io = EXT4_I(inode)->cur_aio_dio;
 
@@ -3416,11 +3495,40 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 	else
 		allocated = map->m_len;
 
-	/* allocate new block */
+	/*
+	 * With bigalloc a logical cluster is backed by a single physical
+	 * cluster.  If a neighbouring extent already maps part of the
+	 * cluster m_lblk falls in, the block is implicitly allocated.
+	 */
+	if (sbi->s_cluster_ratio > 1) {
+		ext4_lblk_t cluster = EXT4_LBLK_CMASK(sbi, map->m_lblk);
+
+		if (ar.pleft && EXT4_LBLK_CMASK(sbi, ar.lleft) == cluster) {
+			newblock = ar.pleft + map->m_lblk - ar.lleft;
+			allocated = min_t(unsigned int, allocated,
+				sbi->s_cluster_ratio -
+				EXT4_LBLK_COFF(sbi, map->m_lblk));
+			ar.len = allocated;
+			goto got_allocated_blocks;
+		}
+		if (ar.pright && EXT4_LBLK_CMASK(sbi, ar.lright) == cluster) {
+			newblock = ar.pright - (ar.lright - map->m_lblk);
+			ar.len = allocated;
+			goto got_allocated_blocks;
+		}
+		/* don't allocate into the cluster the next extent starts in */
+		if (ar.pright && EXT4_LBLK_CMASK(sbi, ar.lright) - map->m_lblk <
+				 allocated)
+			allocated = EXT4_LBLK_CMASK(sbi, ar.lright) -
+				map->m_lblk;
+	}
+
+	/* allocate new block, always starting at a cluster boundary */
+	offset = EXT4_LBLK_COFF(sbi, map->m_lblk);
 	ar.inode = inode;
-	ar.goal = ext4_ext_find_goal(inode, path, map->m_lblk);
-	ar.logical = map->m_lblk;
-	ar.len = allocated;
+	ar.goal = ext4_ext_find_goal(inode, path, map->m_lblk) - offset;
+	ar.logical = map->m_lblk - offset;
+	ar.len = allocated + offset;
 	if (S_ISREG(inode->i_mode))
 		ar.flags = EXT4_MB_HINT_DATA;
 	else
@@ -3431,7 +3539,13 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 		goto out2;
 	ext_debug("allocate new block: goal %llu, found %llu/%u\n",
 		  ar.goal, newblock, allocated);
+	allocated_clusters = EXT4_NUM_B2C(sbi, ar.len);
+	ar.len = EXT4_C2B(sbi, allocated_clusters) - offset;
+	if (ar.len > allocated)
+		ar.len = allocated;
+	newblock += offset;
 
+got_allocated_blocks:
 	/* try to insert new extent into found leaf and return */
 	ext4_ext_store_pblock(&newex, newblock);
 	newex.ee_len = cpu_to_le16(ar.len);
@@ -3461,15 +3575,16 @@ int ext4_ext_map_blocks(handle_t *handle, struct inode *inode,
 		goto out2;
 
 	err = ext4_ext_insert_extent(handle, inode, path, &newex, flags);
-	if (err) {
+	if (err && allocated_clusters) {
 		/* free data blocks we just allocated */
 		/* not a good idea to call discard here directly,
 		 * but otherwise we'd need to call it every free() */
 		ext4_discard_preallocations(inode);
 		ext4_free_blocks(handle, inode, 0, ext4_ext_pblock(&newex),
 				 ext4_ext_get_actual_len(&newex), 0);
-		goto out2;
 	}
+	if (err)
+		goto out2;
 
 	/* previous routine could use block we allocated */
 	newblock = ext4_ext_pblock(&newex);
@@ -3574,6 +3689,295 @@ out_stop:
 	ext4_journal_stop(handle);
 }
 
+/*
+ * ext4_ext_split_at:
+ * makes sure no extent spans across block @split, by splitting the
+ * extent containing it into two extents that meet at @split.
+ */
+static int ext4_ext_split_at(handle_t *handle, struct inode *inode,
+			     ext4_lblk_t split)
+{
+	struct ext4_ext_path *path;
+	struct ext4_extent *ex, newex, orig_ex;
+	ext4_lblk_t ee_block;
+	unsigned int ee_len;
+	int uninitialized;
+	int depth, err = 0;
+
+	path = ext4_ext_find_extent(inode, split, NULL);
+	if (IS_ERR(path))
+		return PTR_ERR(path);
+
+	depth = ext_depth(inode);
+	ex = path[depth].p_ext;
+	if (!ex)
+		goto out;
+
+	ee_block = le32_to_cpu(ex->ee_block);
+	ee_len = ext4_ext_get_actual_len(ex);
+	if (split <= ee_block || split >= ee_block + ee_len)
+		goto out;
+
+	uninitialized = ext4_ext_is_uninitialized(ex);
+	orig_ex = *ex;
+
+	err = ext4_ext_get_access(handle, inode, path + depth);
+	if (err)
+		goto out;
+
+	ex->ee_len = cpu_to_le16(split - ee_block);
+	if (uninitialized)
+		ext4_ext_mark_uninitialized(ex);
+	err = ext4_ext_dirty(handle, inode, path + depth);
+	if (err)
+		goto out;
+
+	newex.ee_block = cpu_to_le32(split);
+	ext4_ext_store_pblock(&newex, ext4_ext_pblock(ex) + split - ee_block);
+	newex.ee_len = cpu_to_le16(ee_block + ee_len - split);
+	if (uninitialized)
+		ext4_ext_mark_uninitialized(&newex);
+
+	/* PRE_IO keeps the two halves from being merged right back */
+	err = ext4_ext_insert_extent(handle, inode, path, &newex,
+				     EXT4_GET_BLOCKS_PRE_IO);
+	if (err) {
+		ex->ee_len = orig_ex.ee_len;
+		ext4_ext_dirty(handle, inode, path + depth);
+	}
+out:
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	return err;
+}
+
+/*
+ * ext4_ext_remove_range:
+ * removes the extents in blocks @start to @end, walking the tree from
+ * right to left.  The range must not split any extent, see
+ * ext4_ext_split_at().  Called with i_data_sem held for writing.
+ */
+static int ext4_ext_remove_range(handle_t *handle, struct inode *inode,
+				 ext4_lblk_t start, ext4_lblk_t end)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_ext_path *path;
+	struct ext4_extent_header *eh;
+	struct ext4_extent *ex;
+	ext4_lblk_t ee_block;
+	unsigned int ee_len;
+	int depth, credits, k;
+	int err = 0;
+
+	while (1) {
+		path = ext4_ext_find_extent(inode, end, NULL);
+		if (IS_ERR(path))
+			return PTR_ERR(path);
+
+		depth = ext_depth(inode);
+		eh = path[depth].p_hdr;
+		ex = path[depth].p_ext;
+
+		if (!ex || le32_to_cpu(ex->ee_block) > end) {
+			/*
+			 * nothing left at or before @end in this leaf, carry
+			 * on left of the deepest index covering @end
+			 */
+			for (k = depth - 1; k >= 0; k--)
+				if (le32_to_cpu(path[k].p_idx->ei_block) <= end)
+					break;
+			if (k < 0 ||
+			    le32_to_cpu(path[k].p_idx->ei_block) <= start)
+				break;
+			end = le32_to_cpu(path[k].p_idx->ei_block) - 1;
+			goto next;
+		}
+
+		ee_block = le32_to_cpu(ex->ee_block);
+		ee_len = ext4_ext_get_actual_len(ex);
+		if (ee_block + ee_len <= start)
+			break;
+		if (unlikely(ee_block < start || ee_block + ee_len - 1 > end)) {
+			EXT4_ERROR_INODE(inode, "extent %u:%u crosses hole "
+					 "%u-%u", ee_block, ee_len, start, end);
+			err = -EIO;
+			break;
+		}
+
+		credits = 7 + 2 * (ee_len / EXT4_BLOCKS_PER_GROUP(sb));
+		credits += depth + 1 + EXT4_MAXQUOTAS_TRANS_BLOCKS(sb);
+		err = ext4_ext_truncate_extend_restart(handle, inode, credits);
+		if (err == -EAGAIN) {
+			/* the tree may have changed while i_data_sem was dropped */
+			err = 0;
+			goto next;
+		}
+		if (err)
+			break;
+
+		err = ext4_ext_get_access(handle, inode, path + depth);
+		if (err)
+			break;
+		err = ext4_remove_blocks(handle, inode, ex, ee_block,
+					 ee_block + ee_len - 1);
+		if (err)
+			break;
+
+		/* keep the leaf packed */
+		if (ex != EXT_LAST_EXTENT(eh))
+			memmove(ex, ex + 1, (EXT_LAST_EXTENT(eh) - ex) *
+				sizeof(struct ext4_extent));
+		memset(EXT_LAST_EXTENT(eh), 0, sizeof(struct ext4_extent));
+		le16_add_cpu(&eh->eh_entries, -1);
+		err = ext4_ext_dirty(handle, inode, path + depth);
+		if (err)
+			break;
+
+		if (eh->eh_entries && ex == EXT_FIRST_EXTENT(eh)) {
+			err = ext4_ext_correct_indexes(handle, inode, path);
+			if (err)
+				break;
+		}
+
+		/* free the leaf and any index block that became empty */
+		for (k = depth; k > 0 && path[k].p_hdr->eh_entries == 0; k--) {
+			err = ext4_ext_rm_idx(handle, inode, path + k, k);
+			if (err)
+				break;
+		}
+		if (err)
+			break;
+
+		if (depth && path[0].p_hdr->eh_entries == 0) {
+			err = ext4_ext_get_access(handle, inode, path);
+			if (err)
+				break;
+			ext_inode_hdr(inode)->eh_depth = 0;
+			ext_inode_hdr(inode)->eh_max =
+				cpu_to_le16(ext4_ext_space_root(inode, 0));
+			err = ext4_ext_dirty(handle, inode, path);
+			if (err)
+				break;
+		}
+
+		if (ee_block <= start)
+			break;
+		end = ee_block - 1;
+next:
+		ext4_ext_drop_refs(path);
+		kfree(path);
+	}
+
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	return err;
+}
+
+/*
+ * ext4_ext_punch_hole:
+ * frees the blocks backing @offset to @offset + @length of an extent
+ * mapped file and drops them from the page cache.  Partial blocks at
+ * either end are zeroed, the file size does not change.  The range is
+ * clamped to i_size rounded up to a page.
+ */
+static long ext4_ext_punch_hole(struct inode *inode, loff_t offset,
+				loff_t length)
+{
+	struct super_block *sb = inode->i_sb;
+	struct address_space *mapping = inode->i_mapping;
+	unsigned int blkbits = inode->i_blkbits;
+	loff_t first_page_offset, last_page_offset;
+	loff_t end, size;
+	u64 first_block, stop_block;
+	handle_t *handle;
+	int credits;
+	int err = 0;
+
+	mutex_lock(&inode->i_mutex);
+
+	/* nothing to punch beyond EOF */
+	size = i_size_read(inode);
+	if (offset >= size)
+		goto out_mutex;
+	if (offset + length > size)
+		length = ((size + PAGE_CACHE_SIZE - 1) & PAGE_CACHE_MASK) -
+			 offset;
+	end = offset + length;
+
+	/*
+	 * write back the pages around the hole, so delayed allocation
+	 * blocks are allocated before we free them and the data outside
+	 * the hole survives dropping the pages
+	 */
+	first_page_offset = offset & PAGE_CACHE_MASK;
+	last_page_offset = (end + PAGE_CACHE_SIZE - 1) & PAGE_CACHE_MASK;
+	err = filemap_write_and_wait_range(mapping, first_page_offset,
+					   last_page_offset - 1);
+	if (err)
+		goto out_mutex;
+
+	unmap_mapping_range(mapping, first_page_offset,
+			    last_page_offset - first_page_offset, 1);
+	truncate_inode_pages_range(mapping, first_page_offset,
+				   last_page_offset - 1);
+
+	credits = ext4_writepage_trans_blocks(inode) +
+		  ext4_ext_calc_credits_for_single_extent(inode, 1, NULL);
+	handle = ext4_journal_start(inode, credits);
+	if (IS_ERR(handle)) {
+		err = PTR_ERR(handle);
+		goto out_mutex;
+	}
+
+	/* zero the partial blocks at both ends of the hole */
+	if (offset & (sb->s_blocksize - 1)) {
+		err = ext4_block_zero_page_range(handle, mapping, offset,
+						 length);
+		if (err)
+			goto out_stop;
+	}
+	if ((end & (sb->s_blocksize - 1)) &&
+	    (end >> blkbits) != (offset >> blkbits)) {
+		err = ext4_block_zero_page_range(handle, mapping,
+				end & ~((loff_t)sb->s_blocksize - 1),
+				end & (sb->s_blocksize - 1));
+		if (err)
+			goto out_stop;
+	}
+
+	first_block = (offset + sb->s_blocksize - 1) >> blkbits;
+	stop_block = end >> blkbits;
+	if (stop_block > EXT_MAX_BLOCK)
+		stop_block = EXT_MAX_BLOCK;
+	if (first_block >= stop_block)
+		goto out_stop;
+
+	down_write(&EXT4_I(inode)->i_data_sem);
+	ext4_ext_invalidate_cache(inode);
+	ext4_discard_preallocations(inode);
+
+	err = ext4_ext_split_at(handle, inode, first_block);
+	if (!err)
+		err = ext4_ext_split_at(handle, inode, stop_block);
+	if (!err)
+		err = ext4_ext_remove_range(handle, inode, first_block,
+					    stop_block - 1);
+
+	ext4_ext_invalidate_cache(inode);
+	up_write(&EXT4_I(inode)->i_data_sem);
+
+	if (IS_SYNC(inode))
+		ext4_handle_sync(handle);
+
+out_stop:
+	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
+	ext4_mark_inode_dirty(handle, inode);
+	ext4_journal_stop(handle);
+out_mutex:
+	mutex_unlock(&inode->i_mutex);
+	return err;
+}
+
 static void ext4_falloc_update_inode(struct inode *inode,
 				int mode, loff_t new_size, int update_ctime)
 {
@@ -3622,6 +4026,14 @@ long ext4_fallocate(struct inode *inode, int mode, loff_t offset, loff_t len)
 	struct ext4_map_blocks map;
 	unsigned int credits, blkbits = inode->i_blkbits;
 
+	/* Preallocated blocks and inline data don't mix. */
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA) ||
+	    ext4_has_inline_data(inode)) {
+		ret = ext4_convert_inline_data(inode);
+		if (ret)
+			return ret;
+	}
+
 	/*
 	 * currently supporting (pre)allocate mode for extent-based
 	 * files _only_
@@ -3633,6 +4045,9 @@ long ext4_fallocate(struct inode *inode, int mode, loff_t offset, loff_t len)
 	if (S_ISDIR(inode->i_mode))
 		return -ENODEV;
 
+	if (mode & FALLOC_FL_PUNCH_HOLE)
+		return ext4_ext_punch_hole(inode, offset, len);
+
 	map.m_lblk = offset >> blkbits;
 	/*
 	 * We can't just convert len to max_blocks because
@@ -3870,6 +4285,13 @@ int ext4_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
 	ext4_lblk_t start_blk;
 	int error = 0;
 
+	if (ext4_has_inline_data(inode)) {
+		error = ext4_inline_data_fiemap(inode, fieinfo);
+		if (error != -EAGAIN)
+			return error;
+		error = 0;
+	}
+
 	/* fallback to generic here if not in extents fmt */
 	if (!(ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)))
 		return generic_block_fiemap(inode, fieinfo, start, len,
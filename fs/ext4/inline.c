@@ -0,0 +1,1252 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+/*
+ * Inline data
+ * -----------
+ * Small regular files keep their data inside the inode: the first
+ * EXT4_MIN_INLINE_DATA_SIZE bytes live in i_block (EXT4_I(inode)->i_data,
+ * written back by ext4_do_update_inode), the remainder in the value of
+ * the in-inode extended attribute "system.data".  The attribute is
+ * created even when it is empty, so that its presence marks the space
+ * as owned by the file.
+ *
+ * Inline data is protected by EXT4_I(inode)->xattr_sem, like the rest
+ * of the in-inode attribute area.  The attribute entry is looked up on
+ * every access because other attribute operations may move it.  Lock
+ * ordering is transaction -> page lock -> xattr_sem.
+ *
+ * Once a write would no longer fit, ext4_convert_inline_data() moves the
+ * data into page 0 of the page cache and the inode falls back to block
+ * (extent) mapping for good.  Small directories are kept inline as well,
+ * see "Inline directories" below.
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include "ext4_jbd2.h"
+#include "ext4.h"
+#include "xattr.h"
+
+static struct ext4_xattr_info ext4_inline_xattr_info = {
+	.name_index = EXT4_XATTR_INDEX_SYSTEM_DATA,
+	.name = EXT4_XATTR_SYSTEM_DATA,
+};
+
+/*
+ * Look up system.data in the inode buffer already held in is->iloc.
+ * Returns -EIO if an inode flagged as inline has lost the attribute.
+ */
+static int ext4_find_inline_xattr(struct inode *inode,
+				  struct ext4_xattr_ibody_find *is)
+{
+	int error;
+
+	is->s.not_found = -ENODATA;
+	error = ext4_xattr_ibody_find(inode, &ext4_inline_xattr_info, is);
+	if (error)
+		return error;
+	if (is->s.not_found) {
+		EXT4_ERROR_INODE(inode, "inline data attribute missing");
+		return -EIO;
+	}
+	return 0;
+}
+
+static inline size_t ext4_inline_value_size(struct ext4_xattr_ibody_find *is)
+{
+	return le32_to_cpu(is->s.here->e_value_size);
+}
+
+static inline void *ext4_inline_value(struct ext4_xattr_ibody_find *is)
+{
+	return is->s.base + le16_to_cpu(is->s.here->e_value_offs);
+}
+
+/*
+ * The largest amount of data @inode could keep inline: i_block plus
+ * whatever the in-inode attribute area can give to system.data.
+ */
+int ext4_get_max_inline_size(struct inode *inode)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct ext4_xattr_entry *last;
+	size_t min_offs, free;
+	int error;
+
+	if (EXT4_I(inode)->i_extra_isize == 0)
+		return 0;
+
+	error = ext4_get_inode_loc(inode, &is.iloc);
+	if (error)
+		return 0;
+	error = ext4_xattr_ibody_find(inode, &ext4_inline_xattr_info, &is);
+	if (error || !is.s.base) {
+		free = 0;
+		goto out;
+	}
+
+	min_offs = is.s.end - is.s.base;
+	last = is.s.first;
+	if (ext4_test_inode_state(inode, EXT4_STATE_XATTR)) {
+		for (; !IS_LAST_ENTRY(last); last = EXT4_XATTR_NEXT(last)) {
+			if (!last->e_value_block && last->e_value_size) {
+				size_t offs = le16_to_cpu(last->e_value_offs);
+				if (offs < min_offs)
+					min_offs = offs;
+			}
+		}
+	}
+	free = min_offs - ((void *)last - is.s.base) - sizeof(__u32);
+
+	if (!is.s.not_found) {
+		free += EXT4_XATTR_SIZE(ext4_inline_value_size(&is));
+	} else {
+		size_t len = EXT4_XATTR_LEN(strlen(EXT4_XATTR_SYSTEM_DATA));
+
+		free = free > len ? free - len : 0;
+		/* Values are padded: only whole pad units are usable. */
+		free &= ~EXT4_XATTR_ROUND;
+	}
+out:
+	brelse(is.iloc.bh);
+	return EXT4_MIN_INLINE_DATA_SIZE + free;
+}
+
+/* Copy up to @len bytes of inline data into @buffer. */
+static int ext4_read_inline_data(struct inode *inode, void *buffer,
+				 size_t len, struct ext4_xattr_ibody_find *is)
+{
+	size_t cp;
+
+	cp = min_t(size_t, len, EXT4_MIN_INLINE_DATA_SIZE);
+	memcpy(buffer, (void *)EXT4_I(inode)->i_data, cp);
+	if (cp == len)
+		return cp;
+
+	len = min_t(size_t, len - cp, ext4_inline_value_size(is));
+	memcpy(buffer + cp, ext4_inline_value(is), len);
+	return cp + len;
+}
+
+static void ext4_write_inline_data(struct inode *inode,
+				   struct ext4_xattr_ibody_find *is,
+				   void *buffer, loff_t pos, unsigned len)
+{
+	unsigned cp;
+
+	if (pos < EXT4_MIN_INLINE_DATA_SIZE) {
+		cp = min_t(unsigned, len, EXT4_MIN_INLINE_DATA_SIZE - pos);
+		memcpy((void *)EXT4_I(inode)->i_data + pos, buffer, cp);
+		buffer += cp;
+		pos += cp;
+		len -= cp;
+	}
+	if (!len)
+		return;
+
+	pos -= EXT4_MIN_INLINE_DATA_SIZE;
+	BUG_ON(pos + len > ext4_inline_value_size(is));
+	memcpy(ext4_inline_value(is) + pos, buffer, len);
+}
+
+/*
+ * Fill page 0 of @inode from the inline data.  Called with the page
+ * locked and xattr_sem held.
+ */
+int ext4_read_inline_page(struct inode *inode, struct page *page)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *kaddr;
+	size_t len;
+	int ret;
+
+	BUG_ON(page->index);
+	if (!ext4_has_inline_data(inode))
+		return -EAGAIN;
+
+	ret = ext4_get_inode_loc(inode, &is.iloc);
+	if (ret)
+		return ret;
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (ret)
+		goto out;
+
+	len = min_t(size_t, i_size_read(inode), PAGE_CACHE_SIZE);
+	kaddr = kmap_atomic(page, KM_USER0);
+	ret = ext4_read_inline_data(inode, kaddr, len, &is);
+	memset(kaddr + ret, 0, PAGE_CACHE_SIZE - ret);
+	flush_dcache_page(page);
+	kunmap_atomic(kaddr, KM_USER0);
+	SetPageUptodate(page);
+out:
+	brelse(is.iloc.bh);
+	return ret;
+}
+
+/*
+ * ->readpage() for inline inodes.  Returns -EAGAIN, with the page still
+ * locked, if the data was converted to blocks in the meantime.
+ */
+int ext4_readpage_inline(struct inode *inode, struct page *page)
+{
+	int ret = 0;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		return -EAGAIN;
+	}
+
+	/* Everything past the inline data is a hole. */
+	if (!page->index)
+		ret = ext4_read_inline_page(inode, page);
+	else if (!PageUptodate(page)) {
+		zero_user_segment(page, 0, PAGE_CACHE_SIZE);
+		SetPageUptodate(page);
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	unlock_page(page);
+	return ret >= 0 ? 0 : ret;
+}
+
+/*
+ * Create an empty system.data for an inode that may take inline data,
+ * sized so that @len bytes fit.
+ */
+static int ext4_create_inline_data(handle_t *handle, struct inode *inode,
+				   unsigned len)
+{
+	struct ext4_xattr_info i = ext4_inline_xattr_info;
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *value = NULL;
+	size_t value_len = 0;
+	int error;
+
+	if (len > EXT4_MIN_INLINE_DATA_SIZE) {
+		value_len = len - EXT4_MIN_INLINE_DATA_SIZE;
+		value = kzalloc(value_len, GFP_NOFS);
+		if (!value)
+			return -ENOMEM;
+	}
+
+	error = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (error)
+		goto out;
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_NEW)) {
+		struct ext4_inode *raw_inode = ext4_raw_inode(&is.iloc);
+		memset(raw_inode, 0, EXT4_SB(inode->i_sb)->s_inode_size);
+		ext4_clear_inode_state(inode, EXT4_STATE_NEW);
+	}
+
+	error = ext4_xattr_ibody_find(inode, &i, &is);
+	if (error)
+		goto out;
+	if (!is.s.not_found) {
+		EXT4_ERROR_INODE(inode, "stale inline data attribute");
+		error = -EIO;
+		goto out;
+	}
+
+	i.value = value ? value : "";
+	i.value_len = value_len;
+	error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+	if (error) {
+		if (error == -ENOSPC)
+			ext4_clear_inode_state(inode,
+					       EXT4_STATE_MAY_INLINE_DATA);
+		goto out;
+	}
+
+	memset((void *)EXT4_I(inode)->i_data, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	ext4_clear_inode_flag(inode, EXT4_INODE_EXTENTS);
+	ext4_set_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+	ext4_set_inode_state(inode, EXT4_STATE_NO_EXPAND);
+
+	error = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	is.iloc.bh = NULL;
+out:
+	kfree(value);
+	brelse(is.iloc.bh);
+	return error;
+}
+
+/* Grow system.data of an inline inode so that @len bytes fit. */
+static int ext4_update_inline_data(handle_t *handle, struct inode *inode,
+				   unsigned len)
+{
+	struct ext4_xattr_info i = ext4_inline_xattr_info;
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	size_t old_len;
+	void *value;
+	int error;
+
+	if (len <= EXT4_MIN_INLINE_DATA_SIZE)
+		return 0;
+
+	error = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (error)
+		return error;
+	error = ext4_find_inline_xattr(inode, &is);
+	if (error)
+		goto out;
+
+	old_len = ext4_inline_value_size(&is);
+	i.value_len = len - EXT4_MIN_INLINE_DATA_SIZE;
+	if (i.value_len <= old_len)
+		goto out;
+
+	value = kzalloc(i.value_len, GFP_NOFS);
+	if (!value) {
+		error = -ENOMEM;
+		goto out;
+	}
+	memcpy(value, ext4_inline_value(&is), old_len);
+	i.value = value;
+	error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+	kfree(value);
+	if (error)
+		goto out;
+
+	error = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	is.iloc.bh = NULL;
+out:
+	brelse(is.iloc.bh);
+	return error;
+}
+
+/*
+ * Make room for @len bytes of inline data, creating system.data if the
+ * inode has none yet.  Returns -ENOSPC if it does not fit.
+ */
+static int ext4_prepare_inline_data(handle_t *handle, struct inode *inode,
+				    unsigned len)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	int ret;
+
+	down_write(&ei->xattr_sem);
+	if (ext4_has_inline_data(inode))
+		ret = ext4_update_inline_data(handle, inode, len);
+	else if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA))
+		ret = ext4_create_inline_data(handle, inode, len);
+	else
+		ret = -ENOSPC;
+	up_write(&ei->xattr_sem);
+	return ret;
+}
+
+/*
+ * ->write_begin() for inodes that have, or may get, inline data.
+ *
+ * Returns 1 with a handle running and page 0 locked in @pagep if the
+ * write goes inline, 0 if the caller should fall back to the block
+ * path (the data has been converted, if there was any), or an error.
+ */
+int ext4_try_to_write_inline_data(struct address_space *mapping,
+				  struct inode *inode,
+				  loff_t pos, unsigned len,
+				  unsigned flags,
+				  struct page **pagep)
+{
+	handle_t *handle;
+	struct page *page;
+	int ret;
+
+	if (pos + len > ext4_get_max_inline_size(inode))
+		return ext4_convert_inline_data(inode);
+
+	handle = ext4_journal_start(inode, 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	ret = ext4_prepare_inline_data(handle, inode, pos + len);
+	if (ret == -ENOSPC) {
+		ext4_journal_stop(handle);
+		return ext4_convert_inline_data(inode);
+	}
+	if (ret)
+		goto out_stop;
+
+	/* We cannot recurse into the filesystem as the transaction is
+	 * already started */
+	flags |= AOP_FLAG_NOFS;
+
+	page = grab_cache_page_write_begin(mapping, 0, flags);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_stop;
+	}
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		/* Converted under us by a page fault. */
+		ret = 0;
+		goto out_release;
+	}
+	if (!PageUptodate(page)) {
+		ret = ext4_read_inline_page(inode, page);
+		if (ret < 0)
+			goto out_release;
+	}
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	*pagep = page;
+	return 1;
+
+out_release:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	unlock_page(page);
+	page_cache_release(page);
+out_stop:
+	ext4_journal_stop(handle);
+	return ret;
+}
+
+/*
+ * Copy a write completed in page 0 into the inode.  The page stays
+ * clean: the data reaches disk with the inode, never through writeback.
+ * Returns the number of bytes copied.
+ */
+int ext4_write_inline_data_end(struct inode *inode, loff_t pos, unsigned len,
+			       unsigned copied, struct page *page)
+{
+	handle_t *handle = ext4_journal_current_handle();
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *kaddr;
+	int ret;
+
+	if (unlikely(copied < len) && !PageUptodate(page))
+		return 0;
+
+	ret = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (ret)
+		goto out_err;
+
+	down_write(&EXT4_I(inode)->xattr_sem);
+	ret = ext4_find_inline_xattr(inode, &is);
+	if (ret) {
+		up_write(&EXT4_I(inode)->xattr_sem);
+		brelse(is.iloc.bh);
+		goto out_err;
+	}
+	kaddr = kmap_atomic(page, KM_USER0);
+	ext4_write_inline_data(inode, &is, kaddr + pos, pos, copied);
+	kunmap_atomic(kaddr, KM_USER0);
+	SetPageUptodate(page);
+	ClearPageDirty(page);
+	up_write(&EXT4_I(inode)->xattr_sem);
+
+	ret = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	if (ret)
+		goto out_err;
+	return copied;
+
+out_err:
+	ext4_std_error(inode->i_sb, ret);
+	return 0;
+}
+
+/*
+ * Drop the inline data of @inode and switch it to block mapping.  The
+ * caller holds xattr_sem and has saved the data elsewhere.
+ */
+int ext4_destroy_inline_data(handle_t *handle, struct inode *inode)
+{
+	struct ext4_xattr_info i = ext4_inline_xattr_info;
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int error;
+
+	error = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (error)
+		return error;
+	error = ext4_find_inline_xattr(inode, &is);
+	if (error)
+		goto out;
+
+	error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+	if (error)
+		goto out;
+
+	memset((void *)EXT4_I(inode)->i_data, 0, EXT4_MIN_INLINE_DATA_SIZE);
+	ext4_clear_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+
+	error = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	is.iloc.bh = NULL;
+	if (!error && EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
+					EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+		ext4_set_inode_flag(inode, EXT4_INODE_EXTENTS);
+		error = ext4_ext_tree_init(handle, inode);
+	}
+	/*
+	 * Not before ext4_ext_tree_init() has marked the inode dirty:
+	 * expanding i_extra_isize takes xattr_sem, which we hold.
+	 */
+	ext4_clear_inode_state(inode, EXT4_STATE_NO_EXPAND);
+out:
+	brelse(is.iloc.bh);
+	return error;
+}
+
+/* Shrink the inline data of @inode to its new i_size. */
+void ext4_inline_data_truncate(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_xattr_info i = ext4_inline_xattr_info;
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	handle_t *handle;
+	loff_t i_size = inode->i_size;
+	void *value = NULL;
+	int error;
+
+	handle = ext4_journal_start(inode, 2);
+	if (IS_ERR(handle))
+		return;
+
+	down_write(&ei->xattr_sem);
+	if (!ext4_has_inline_data(inode))
+		goto out_unlock;
+
+	error = ext4_reserve_inode_write(handle, inode, &is.iloc);
+	if (error)
+		goto out_err;
+	error = ext4_find_inline_xattr(inode, &is);
+	if (error)
+		goto out_err;
+
+	if (i_size < EXT4_MIN_INLINE_DATA_SIZE)
+		memset((void *)ei->i_data + i_size, 0,
+		       EXT4_MIN_INLINE_DATA_SIZE - i_size);
+
+	i.value_len = i_size > EXT4_MIN_INLINE_DATA_SIZE ?
+			i_size - EXT4_MIN_INLINE_DATA_SIZE : 0;
+	if (i.value_len < ext4_inline_value_size(&is)) {
+		if (i.value_len) {
+			value = kmalloc(i.value_len, GFP_NOFS);
+			if (!value) {
+				error = -ENOMEM;
+				goto out_err;
+			}
+			memcpy(value, ext4_inline_value(&is), i.value_len);
+		}
+		i.value = value ? value : "";
+		error = ext4_xattr_ibody_set(handle, inode, &i, &is);
+		kfree(value);
+		if (error)
+			goto out_err;
+	}
+
+	ei->i_disksize = i_size;
+	error = ext4_mark_iloc_dirty(handle, inode, &is.iloc);
+	is.iloc.bh = NULL;
+	if (!error)
+		goto out_unlock;
+out_err:
+	ext4_std_error(inode->i_sb, error);
+out_unlock:
+	up_write(&ei->xattr_sem);
+	brelse(is.iloc.bh);
+	if (inode->i_nlink)
+		ext4_orphan_del(handle, inode);
+	ext4_journal_stop(handle);
+}
+
+/*
+ * Inline directories
+ * ------------------
+ * An inline directory keeps the inode number of its parent in the first
+ * four bytes of i_block, followed by directory entries filling the rest
+ * of i_block.  More entries may follow in system.data; they form a chain
+ * of their own, no entry crosses from i_block into the attribute.  "."
+ * is implied and i_size is the size of the inline data.
+ *
+ * The directory's i_mutex serializes changes to the entries, xattr_sem
+ * keeps system.data in place while it is used.  Once an entry no longer
+ * fits, ext4_convert_inline_dir() moves them into a directory block.
+ *
+ * readdir positions are those the entries get in that block, behind
+ * real "." and ".." entries, so they stay valid across the conversion.
+ */
+#define EXT4_INLINE_DOTDOT_SIZE		4
+#define EXT4_INLINE_DIR_IBLOCK_SIZE	(EXT4_MIN_INLINE_DATA_SIZE - \
+					 EXT4_INLINE_DOTDOT_SIZE)
+
+#define EXT4_INLINE_DOTDOT_POS		EXT4_DIR_REC_LEN(1)
+#define EXT4_INLINE_DIRENT_POS		(EXT4_DIR_REC_LEN(1) + \
+					 EXT4_DIR_REC_LEN(2))
+/* Add to an offset into the inline data to get its readdir position. */
+#define EXT4_INLINE_POS_SHIFT		(EXT4_INLINE_DIRENT_POS - \
+					 EXT4_INLINE_DOTDOT_SIZE)
+
+static inline void *ext4_inline_dir_start(struct inode *dir)
+{
+	return (void *)EXT4_I(dir)->i_data + EXT4_INLINE_DOTDOT_SIZE;
+}
+
+/*
+ * Set up @inode, a new directory in @parent, as an empty inline
+ * directory.  Returns -ENOSPC if it has to be block based.
+ */
+int ext4_try_create_inline_dir(handle_t *handle, struct inode *parent,
+			       struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_dir_entry_2 *de;
+	int ret;
+
+	ret = ext4_prepare_inline_data(handle, inode,
+				       EXT4_MIN_INLINE_DATA_SIZE);
+	if (ret)
+		return ret;
+
+	down_write(&ei->xattr_sem);
+	ei->i_data[0] = cpu_to_le32(parent->i_ino);
+	de = ext4_inline_dir_start(inode);
+	de->inode = 0;
+	de->rec_len = ext4_rec_len_to_disk(EXT4_INLINE_DIR_IBLOCK_SIZE,
+					   inode->i_sb->s_blocksize);
+	up_write(&ei->xattr_sem);
+
+	inode->i_size = ei->i_disksize = EXT4_MIN_INLINE_DATA_SIZE;
+	return ext4_mark_inode_dirty(handle, inode);
+}
+
+/*
+ * ext4_find_entry() for inline directories.  Returns the inode buffer
+ * with *@res_dir pointing at the entry, either in EXT4_I(dir)->i_data
+ * or in system.data.  ".." is found in front of the entries: only its
+ * ->inode is valid.  Clears *@has_inline_data if @dir was converted.
+ */
+struct buffer_head *ext4_find_inline_entry(struct inode *dir,
+					   const struct qstr *d_name,
+					   struct ext4_dir_entry_2 **res_dir,
+					   int *has_inline_data)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int ret;
+
+	if (ext4_get_inode_loc(dir, &is.iloc))
+		return NULL;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!ext4_has_inline_data(dir)) {
+		*has_inline_data = 0;
+		goto out;
+	}
+
+	if (d_name->len == 2 && !memcmp(d_name->name, "..", 2)) {
+		*res_dir = (struct ext4_dir_entry_2 *)EXT4_I(dir)->i_data;
+		goto found;
+	}
+
+	ret = ext4_search_dir(is.iloc.bh, ext4_inline_dir_start(dir),
+			      EXT4_INLINE_DIR_IBLOCK_SIZE, dir, d_name,
+			      EXT4_INLINE_DOTDOT_SIZE, res_dir);
+	if (ret == 1)
+		goto found;
+	if (ret < 0)
+		goto out;
+
+	if (ext4_find_inline_xattr(dir, &is))
+		goto out;
+	if (ext4_inline_value_size(&is) &&
+	    ext4_search_dir(is.iloc.bh, ext4_inline_value(&is),
+			    ext4_inline_value_size(&is), dir, d_name,
+			    EXT4_MIN_INLINE_DATA_SIZE, res_dir) == 1)
+		goto found;
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(is.iloc.bh);
+	return NULL;
+found:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	return is.iloc.bh;
+}
+
+/*
+ * Insert the entry for @dentry into the @size bytes of entries at @buf.
+ * Returns -ENOSPC if there is no room.
+ */
+static int ext4_add_dirent_to_inline(handle_t *handle, struct dentry *dentry,
+				     struct inode *inode,
+				     struct ext4_iloc *iloc,
+				     void *buf, int size)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	const char *name = (const char *)dentry->d_name.name;
+	int namelen = dentry->d_name.len;
+	struct ext4_dir_entry_2 *de;
+	int err;
+
+	err = ext4_find_dest_de(dir, inode, iloc->bh, buf, size,
+				name, namelen, &de);
+	if (err)
+		return err;
+
+	BUFFER_TRACE(iloc->bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, iloc->bh);
+	if (err)
+		return err;
+	ext4_insert_dentry(inode, de, size, name, namelen);
+	return 0;
+}
+
+/*
+ * Grow system.data of inline directory @dir as far as the inode allows
+ * and give the new space to its last entry, or to a new empty entry.
+ * Returns -ENOSPC if that would not gain @min_len bytes.  Called with
+ * xattr_sem held for writing; @is is looked up again.
+ */
+static int ext4_expand_inline_dir(handle_t *handle, struct inode *dir,
+				  struct ext4_xattr_ibody_find *is,
+				  int min_len)
+{
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	struct ext4_dir_entry_2 *de;
+	int old_len, new_len, pos, rlen;
+	int ret;
+
+	old_len = ext4_inline_value_size(is);
+	new_len = (ext4_get_max_inline_size(dir) -
+		   EXT4_MIN_INLINE_DATA_SIZE) & ~3;
+	if (new_len - old_len < min_len)
+		return -ENOSPC;
+
+	ret = ext4_update_inline_data(handle, dir,
+				      EXT4_MIN_INLINE_DATA_SIZE + new_len);
+	if (ret)
+		return ret;
+	ret = ext4_find_inline_xattr(dir, is);
+	if (ret)
+		return ret;
+	BUFFER_TRACE(is->iloc.bh, "get_write_access");
+	ret = ext4_journal_get_write_access(handle, is->iloc.bh);
+	if (ret)
+		return ret;
+
+	de = ext4_inline_value(is);
+	if (!old_len) {
+		de->inode = 0;
+		de->rec_len = ext4_rec_len_to_disk(new_len, blocksize);
+		goto out;
+	}
+	for (pos = 0; ; pos += rlen) {
+		de = ext4_inline_value(is) + pos;
+		rlen = ext4_rec_len_from_disk(de->rec_len, blocksize);
+		if (!ext4_check_dir_entry(dir, de, is->iloc.bh,
+					  ext4_inline_value(is), old_len,
+					  EXT4_MIN_INLINE_DATA_SIZE + pos))
+			return -EIO;
+		if (pos + rlen == old_len)
+			break;
+	}
+	de->rec_len = ext4_rec_len_to_disk(rlen + new_len - old_len, blocksize);
+out:
+	dir->i_size = EXT4_I(dir)->i_disksize =
+		EXT4_MIN_INLINE_DATA_SIZE + new_len;
+	return 0;
+}
+
+/*
+ * Check the entries in the @size bytes of inline directory data at @buf
+ * and return the offset of the last one.
+ */
+static int ext4_inline_dir_last_de(struct inode *dir, void *buf, int size)
+{
+	struct ext4_dir_entry_2 *de;
+	int pos = EXT4_INLINE_DOTDOT_SIZE;
+	int rlen;
+
+	while (pos + EXT4_DIR_REC_LEN(1) <= size) {
+		de = buf + pos;
+		rlen = ext4_rec_len_from_disk(de->rec_len,
+					      dir->i_sb->s_blocksize);
+		if (rlen < EXT4_DIR_REC_LEN(de->name_len) || rlen % 4 ||
+		    pos + rlen > size)
+			break;
+		if (pos + rlen == size)
+			return pos;
+		pos += rlen;
+	}
+	EXT4_ERROR_INODE(dir, "bad inline directory entry at offset %d", pos);
+	return -EIO;
+}
+
+/* Put back the inline data of @dir after a failed conversion. */
+static void ext4_restore_inline_dir(handle_t *handle, struct inode *dir,
+				    void *buf, int size)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int error;
+
+	down_write(&EXT4_I(dir)->xattr_sem);
+	error = ext4_create_inline_data(handle, dir, size);
+	if (error)
+		goto out;
+	error = ext4_reserve_inode_write(handle, dir, &is.iloc);
+	if (error)
+		goto out;
+	error = ext4_find_inline_xattr(dir, &is);
+	if (!error) {
+		ext4_write_inline_data(dir, &is, buf, 0, size);
+		dir->i_size = EXT4_I(dir)->i_disksize = size;
+		error = ext4_mark_iloc_dirty(handle, dir, &is.iloc);
+		is.iloc.bh = NULL;
+	}
+	brelse(is.iloc.bh);
+out:
+	up_write(&EXT4_I(dir)->xattr_sem);
+	if (error)
+		ext4_std_error(dir->i_sb, error);
+}
+
+/*
+ * Move the entries of inline directory @dir into a new first block,
+ * behind real "." and ".." entries.  The entries keep their offsets
+ * relative to each other and the last one takes up the rest of the
+ * block.
+ */
+static int ext4_convert_inline_dir(handle_t *handle, struct inode *dir)
+{
+	struct ext4_inode_info *ei = EXT4_I(dir);
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	unsigned int blocksize = dir->i_sb->s_blocksize;
+	struct ext4_dir_entry_2 *de;
+	struct buffer_head *bh;
+	void *buf = NULL;
+	int inline_size, last;
+	int error;
+
+	error = ext4_get_inode_loc(dir, &is.iloc);
+	if (error)
+		return error;
+
+	down_write(&ei->xattr_sem);
+	error = ext4_find_inline_xattr(dir, &is);
+	if (error)
+		goto out_unlock;
+	inline_size = EXT4_MIN_INLINE_DATA_SIZE + ext4_inline_value_size(&is);
+	if (inline_size + EXT4_INLINE_POS_SHIFT > blocksize) {
+		EXT4_ERROR_INODE(dir, "inline directory too large: %d",
+				 inline_size);
+		error = -EIO;
+		goto out_unlock;
+	}
+	buf = kmalloc(inline_size, GFP_NOFS);
+	if (!buf) {
+		error = -ENOMEM;
+		goto out_unlock;
+	}
+	ext4_read_inline_data(dir, buf, inline_size, &is);
+	last = ext4_inline_dir_last_de(dir, buf, inline_size);
+	if (last < 0) {
+		error = last;
+		goto out_unlock;
+	}
+	error = ext4_destroy_inline_data(handle, dir);
+	up_write(&ei->xattr_sem);
+	brelse(is.iloc.bh);
+	if (error)
+		goto out;
+
+	dir->i_size = ei->i_disksize = blocksize;
+	bh = ext4_bread(handle, dir, 0, 1, &error);
+	if (!bh) {
+		ext4_restore_inline_dir(handle, dir, buf, inline_size);
+		goto out;
+	}
+	BUFFER_TRACE(bh, "get_write_access");
+	error = ext4_journal_get_write_access(handle, bh);
+	if (error) {
+		brelse(bh);
+		goto out;
+	}
+	de = ext4_init_dot_dotdot(dir, (struct ext4_dir_entry_2 *)bh->b_data,
+				  blocksize, le32_to_cpu(*(__le32 *)buf), 1);
+	memcpy(de, buf + EXT4_INLINE_DOTDOT_SIZE,
+	       inline_size - EXT4_INLINE_DOTDOT_SIZE);
+	de = (void *)de + last - EXT4_INLINE_DOTDOT_SIZE;
+	de->rec_len = ext4_rec_len_to_disk(bh->b_data + blocksize - (char *)de,
+					   blocksize);
+	BUFFER_TRACE(bh, "call ext4_handle_dirty_metadata");
+	error = ext4_handle_dirty_metadata(handle, dir, bh);
+	brelse(bh);
+	if (!error)
+		error = ext4_mark_inode_dirty(handle, dir);
+out:
+	kfree(buf);
+	return error;
+
+out_unlock:
+	up_write(&ei->xattr_sem);
+	brelse(is.iloc.bh);
+	kfree(buf);
+	return error;
+}
+
+/*
+ * ext4_add_entry() for inline directories.  Returns 1 if the entry for
+ * @dentry was added, 0 if @dir had to be converted to a directory block
+ * first, in which case the caller adds it there.
+ */
+int ext4_try_add_inline_entry(handle_t *handle, struct dentry *dentry,
+			      struct inode *inode)
+{
+	struct inode *dir = dentry->d_parent->d_inode;
+	struct ext4_inode_info *ei = EXT4_I(dir);
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int ret;
+
+	ret = ext4_get_inode_loc(dir, &is.iloc);
+	if (ret)
+		return ret;
+
+	down_write(&ei->xattr_sem);
+	if (!ext4_has_inline_data(dir))
+		goto out;
+
+	ret = ext4_add_dirent_to_inline(handle, dentry, inode, &is.iloc,
+					ext4_inline_dir_start(dir),
+					EXT4_INLINE_DIR_IBLOCK_SIZE);
+	if (ret != -ENOSPC)
+		goto out;
+
+	ret = ext4_find_inline_xattr(dir, &is);
+	if (ret)
+		goto out;
+	if (ext4_inline_value_size(&is)) {
+		ret = ext4_add_dirent_to_inline(handle, dentry, inode,
+						&is.iloc,
+						ext4_inline_value(&is),
+						ext4_inline_value_size(&is));
+		if (ret != -ENOSPC)
+			goto out;
+	}
+
+	ret = ext4_expand_inline_dir(handle, dir, &is,
+				     EXT4_DIR_REC_LEN(dentry->d_name.len));
+	if (!ret)
+		ret = ext4_add_dirent_to_inline(handle, dentry, inode,
+						&is.iloc,
+						ext4_inline_value(&is),
+						ext4_inline_value_size(&is));
+	if (ret == -ENOSPC) {
+		up_write(&ei->xattr_sem);
+		brelse(is.iloc.bh);
+		return ext4_convert_inline_dir(handle, dir);
+	}
+out:
+	up_write(&ei->xattr_sem);
+	brelse(is.iloc.bh);
+	if (ret || !ext4_has_inline_data(dir))
+		return ret;
+
+	dir->i_mtime = dir->i_ctime = ext4_current_time(dir);
+	dir->i_version++;
+	ret = ext4_mark_inode_dirty(handle, dir);
+	return ret ? ret : 1;
+}
+
+/* ext4_delete_entry() for inline directories. */
+int ext4_delete_inline_entry(handle_t *handle, struct inode *dir,
+			     struct ext4_dir_entry_2 *de_del,
+			     struct buffer_head *bh)
+{
+	struct ext4_inode_info *ei = EXT4_I(dir);
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	void *buf;
+	int size;
+	int err;
+
+	err = ext4_get_inode_loc(dir, &is.iloc);
+	if (err)
+		return err;
+
+	down_write(&ei->xattr_sem);
+	if ((void *)de_del >= ext4_inline_dir_start(dir) &&
+	    (void *)de_del < (void *)ei->i_data + EXT4_MIN_INLINE_DATA_SIZE) {
+		buf = ext4_inline_dir_start(dir);
+		size = EXT4_INLINE_DIR_IBLOCK_SIZE;
+	} else {
+		err = ext4_find_inline_xattr(dir, &is);
+		if (err)
+			goto out;
+		buf = ext4_inline_value(&is);
+		size = ext4_inline_value_size(&is);
+	}
+
+	BUFFER_TRACE(bh, "get_write_access");
+	err = ext4_journal_get_write_access(handle, bh);
+	if (!err)
+		err = ext4_generic_delete_entry(handle, dir, de_del, bh,
+						buf, size);
+out:
+	up_write(&ei->xattr_sem);
+	brelse(is.iloc.bh);
+	if (!err)
+		err = ext4_mark_inode_dirty(handle, dir);
+	return err;
+}
+
+/* Returns 0 if the @size bytes of entries at @buf name any inode. */
+static int ext4_inline_dirents_empty(struct inode *dir, struct buffer_head *bh,
+				     void *buf, int size, unsigned int offset)
+{
+	struct ext4_dir_entry_2 *de;
+	int pos = 0;
+
+	while (pos < size) {
+		de = buf + pos;
+		if (!ext4_check_dir_entry(dir, de, bh, buf, size, offset + pos))
+			break;
+		if (le32_to_cpu(de->inode))
+			return 0;
+		pos += ext4_rec_len_from_disk(de->rec_len,
+					      dir->i_sb->s_blocksize);
+	}
+	return 1;
+}
+
+/* empty_dir() for inline directories. */
+int ext4_empty_inline_dir(struct inode *dir)
+{
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	int ret = 1;
+
+	if (ext4_get_inode_loc(dir, &is.iloc))
+		return 1;
+
+	down_read(&EXT4_I(dir)->xattr_sem);
+	if (!le32_to_cpu(EXT4_I(dir)->i_data[0])) {
+		ext4_warning(dir->i_sb, "bad inline directory (dir #%lu) - "
+			     "no `..'", dir->i_ino);
+		goto out;
+	}
+	ret = ext4_inline_dirents_empty(dir, is.iloc.bh,
+					ext4_inline_dir_start(dir),
+					EXT4_INLINE_DIR_IBLOCK_SIZE,
+					EXT4_INLINE_DOTDOT_SIZE);
+	if (!ret || ext4_find_inline_xattr(dir, &is))
+		goto out;
+	ret = ext4_inline_dirents_empty(dir, is.iloc.bh,
+					ext4_inline_value(&is),
+					ext4_inline_value_size(&is),
+					EXT4_MIN_INLINE_DATA_SIZE);
+out:
+	up_read(&EXT4_I(dir)->xattr_sem);
+	brelse(is.iloc.bh);
+	return ret;
+}
+
+/*
+ * ext4_readdir() for inline directories.  Works on a copy of the
+ * entries so that filldir is not called with xattr_sem held.  Returns
+ * -EAGAIN if the directory has been converted to blocks.
+ */
+int ext4_read_inline_dir(struct file *filp, void *dirent, filldir_t filldir)
+{
+	struct inode *inode = filp->f_path.dentry->d_inode;
+	struct super_block *sb = inode->i_sb;
+	struct ext4_xattr_ibody_find is = {
+		.s = { .not_found = -ENODATA, },
+	};
+	struct ext4_dir_entry_2 *de;
+	unsigned int parent_ino;
+	int inline_size, end, offset, i;
+	void *buf;
+	int err;
+
+	err = ext4_get_inode_loc(inode, &is.iloc);
+	if (err)
+		return err;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		brelse(is.iloc.bh);
+		return -EAGAIN;
+	}
+	err = ext4_find_inline_xattr(inode, &is);
+	if (err) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		goto out;
+	}
+	inline_size = EXT4_MIN_INLINE_DATA_SIZE + ext4_inline_value_size(&is);
+	buf = kmalloc(inline_size, GFP_NOFS);
+	if (!buf) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		err = -ENOMEM;
+		goto out;
+	}
+	ext4_read_inline_data(inode, buf, inline_size, &is);
+	up_read(&EXT4_I(inode)->xattr_sem);
+
+	parent_ino = le32_to_cpu(*(__le32 *)buf);
+	end = inline_size + EXT4_INLINE_POS_SHIFT;
+
+	/*
+	 * If the directory has changed since the last call to readdir(2),
+	 * or we were seeked between "." and the first entry, scan from
+	 * the start to find an entry boundary.
+	 */
+	offset = filp->f_pos;
+	if (filp->f_version != inode->i_version ||
+	    (offset < EXT4_INLINE_DIRENT_POS && offset &&
+	     offset != EXT4_INLINE_DOTDOT_POS)) {
+		for (i = 0; i < end && i < offset; ) {
+			if (!i) {
+				i = EXT4_INLINE_DOTDOT_POS;
+				continue;
+			}
+			if (i == EXT4_INLINE_DOTDOT_POS) {
+				i = EXT4_INLINE_DIRENT_POS;
+				continue;
+			}
+			de = buf + i - EXT4_INLINE_POS_SHIFT;
+			if (ext4_rec_len_from_disk(de->rec_len,
+					sb->s_blocksize) < EXT4_DIR_REC_LEN(1))
+				break;
+			i += ext4_rec_len_from_disk(de->rec_len,
+						    sb->s_blocksize);
+		}
+		filp->f_pos = i;
+		filp->f_version = inode->i_version;
+	}
+
+	while (filp->f_pos < end) {
+		if (!filp->f_pos) {
+			if (filldir(dirent, ".", 1, 0, inode->i_ino, DT_DIR))
+				break;
+			filp->f_pos = EXT4_INLINE_DOTDOT_POS;
+			continue;
+		}
+		if (filp->f_pos == EXT4_INLINE_DOTDOT_POS) {
+			if (filldir(dirent, "..", 2, filp->f_pos, parent_ino,
+				    DT_DIR))
+				break;
+			filp->f_pos = EXT4_INLINE_DIRENT_POS;
+			continue;
+		}
+
+		offset = filp->f_pos - EXT4_INLINE_POS_SHIFT;
+		de = buf + offset;
+		if (!ext4_check_dir_entry(inode, de, is.iloc.bh, buf,
+					  inline_size, offset)) {
+			filp->f_pos = end;
+			break;
+		}
+		if (le32_to_cpu(de->inode) &&
+		    filldir(dirent, de->name, de->name_len, filp->f_pos,
+			    le32_to_cpu(de->inode),
+			    get_dtype(sb, de->file_type)))
+			break;
+		filp->f_pos += ext4_rec_len_from_disk(de->rec_len,
+						      sb->s_blocksize);
+	}
+	kfree(buf);
+out:
+	brelse(is.iloc.bh);
+	return err;
+}
+
+/*
+ * The ".." entry of inline directory @inode for ext4_rename(): the
+ * parent's inode number in i_block lines up with de->inode.
+ */
+struct buffer_head *ext4_get_first_inline_block(struct inode *inode,
+					struct ext4_dir_entry_2 **parent_de,
+					int *retval)
+{
+	struct ext4_iloc iloc;
+
+	*retval = ext4_get_inode_loc(inode, &iloc);
+	if (*retval)
+		return NULL;
+	*parent_de = (struct ext4_dir_entry_2 *)EXT4_I(inode)->i_data;
+	return iloc.bh;
+}
+
+/* Report the inline data of @inode as a single FIEMAP extent. */
+int ext4_inline_data_fiemap(struct inode *inode,
+			    struct fiemap_extent_info *fieinfo)
+{
+	struct ext4_iloc iloc;
+	__u64 physical;
+	__u64 length;
+	int error;
+
+	error = fiemap_check_flags(fieinfo, FIEMAP_FLAG_SYNC);
+	if (error)
+		return error;
+
+	down_read(&EXT4_I(inode)->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		up_read(&EXT4_I(inode)->xattr_sem);
+		return -EAGAIN;
+	}
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error)
+		goto out;
+
+	physical = (__u64)iloc.bh->b_blocknr << inode->i_sb->s_blocksize_bits;
+	physical += (char *)ext4_raw_inode(&iloc) - iloc.bh->b_data;
+	physical += offsetof(struct ext4_inode, i_block);
+	length = i_size_read(inode);
+	brelse(iloc.bh);
+
+	if (length)
+		error = fiemap_fill_next_extent(fieinfo, 0, physical, length,
+						FIEMAP_EXTENT_DATA_INLINE |
+						FIEMAP_EXTENT_NOT_ALIGNED |
+						FIEMAP_EXTENT_LAST);
+	if (error > 0)
+		error = 0;
+out:
+	up_read(&EXT4_I(inode)->xattr_sem);
+	return error;
+}
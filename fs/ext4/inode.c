@@ -990,6 +990,14 @@ static int ext4_ind_map_blocks(handle_t *handle, struct inode *inode,
 	/*
 	 * Okay, we need to do block allocation.
 	*/
+	if (EXT4_HAS_RO_COMPAT_FEATURE(inode->i_sb,
+				       EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+		EXT4_ERROR_INODE(inode, "Can't allocate blocks for "
+				 "non-extent mapped inodes with bigalloc");
+		err = -EIO;
+		goto cleanup;
+	}
+
 	goal = ext4_find_goal(inode, map->m_lblk, partial);
 
 	/* the number of blocks need to allocate for [d,t]indirect blocks */
@@ -1261,6 +1269,11 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 	ext_debug("ext4_map_blocks(): inode %lu, flag %d, max_blocks %u,"
 		  "logical block %lu\n", inode->i_ino, flags, map->m_len,
 		  (unsigned long) map->m_lblk);
+
+	/* i_block holds file data; callers must convert it first. */
+	if (WARN_ON_ONCE(ext4_has_inline_data(inode)))
+		return -EIO;
+
 	/*
 	 * Try to see if we can get the block without requesting a new
 	 * file system block.
@@ -1283,6 +1296,9 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 	if ((flags & EXT4_GET_BLOCKS_CREATE) == 0)
 		return retval;
 
+	/* Once the inode owns blocks its data can no longer go inline. */
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+
 	/*
 	 * Returns if the blocks have already allocated
 	 *
@@ -1593,6 +1609,19 @@ static int ext4_write_begin(struct file *file, struct address_space *mapping,
 	unsigned from, to;
 
 	trace_ext4_write_begin(inode, pos, len, flags);
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA) ||
+	    ext4_has_inline_data(inode)) {
+		ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+						    flags, pagep);
+		if (ret < 0)
+			goto out;
+		if (ret == 1) {
+			ret = 0;
+			goto out;
+		}
+	}
+
 	/*
 	 * Reserve one block more for addition to orphan list in case
 	 * we allocate blocks but write fails for some reason
@@ -1683,7 +1712,12 @@ static int ext4_generic_write_end(struct file *file,
 	struct inode *inode = mapping->host;
 	handle_t *handle = ext4_journal_current_handle();
 
-	copied = block_write_end(file, mapping, pos, len, copied, page, fsdata);
+	if (ext4_has_inline_data(inode))
+		copied = ext4_write_inline_data_end(inode, pos, len, copied,
+						    page);
+	else
+		copied = block_write_end(file, mapping, pos, len, copied,
+					 page, fsdata);
 
 	/*
 	 * No need to use i_size_read() here, the i_size
@@ -1828,16 +1862,21 @@ static int ext4_journalled_write_end(struct file *file,
 	from = pos & (PAGE_CACHE_SIZE - 1);
 	to = from + len;
 
-	if (copied < len) {
-		if (!PageUptodate(page))
-			copied = 0;
-		page_zero_new_buffers(page, from+copied, to);
-	}
+	if (ext4_has_inline_data(inode)) {
+		copied = ext4_write_inline_data_end(inode, pos, len, copied,
+						    page);
+	} else {
+		if (copied < len) {
+			if (!PageUptodate(page))
+				copied = 0;
+			page_zero_new_buffers(page, from+copied, to);
+		}
 
-	ret = walk_page_buffers(handle, page_buffers(page), from,
-				to, &partial, write_end_fn);
-	if (!partial)
-		SetPageUptodate(page);
+		ret = walk_page_buffers(handle, page_buffers(page), from,
+					to, &partial, write_end_fn);
+		if (!partial)
+			SetPageUptodate(page);
+	}
 	new_i_size = pos + copied;
 	if (new_i_size > inode->i_size)
 		i_size_write(inode, pos+copied);
@@ -1875,6 +1914,90 @@ static int ext4_journalled_write_end(struct file *file,
 	return ret ? ret : copied;
 }
 
+/*
+ * Move the inline data of @inode into block 0 and switch the inode to
+ * block mapping.  Also called for inodes that merely may get inline
+ * data, to take them out of the running before they map blocks.
+ */
+int ext4_convert_inline_data(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	handle_t *handle;
+	struct page *page;
+	unsigned len;
+	int ret, truncate = 0;
+
+	if (!ext4_has_inline_data(inode)) {
+		ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+		return 0;
+	}
+
+	handle = ext4_journal_start(inode,
+				    ext4_writepage_trans_blocks(inode) + 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	page = grab_cache_page_write_begin(inode->i_mapping, 0,
+					   AOP_FLAG_NOFS);
+	if (!page) {
+		ext4_journal_stop(handle);
+		return -ENOMEM;
+	}
+
+	down_write(&ei->xattr_sem);
+	if (!ext4_has_inline_data(inode)) {
+		/* Somebody else converted it while we waited for the page. */
+		up_write(&ei->xattr_sem);
+		ret = 0;
+		goto out;
+	}
+	if (!PageUptodate(page)) {
+		ret = ext4_read_inline_page(inode, page);
+		if (ret < 0) {
+			up_write(&ei->xattr_sem);
+			goto out;
+		}
+	}
+	ret = ext4_destroy_inline_data(handle, inode);
+	up_write(&ei->xattr_sem);
+	if (ret)
+		goto out;
+
+	/* The page now holds the only copy of the data: write it out. */
+	len = min_t(loff_t, i_size_read(inode), PAGE_CACHE_SIZE);
+	if (!len)
+		goto out;
+	ret = __block_write_begin(page, 0, len, ext4_get_block);
+	if (!ret && ext4_should_journal_data(inode)) {
+		ret = walk_page_buffers(handle, page_buffers(page), 0, len,
+					NULL, do_journal_get_write_access);
+		if (!ret)
+			ret = walk_page_buffers(handle, page_buffers(page),
+						0, len, NULL, write_end_fn);
+		ext4_set_inode_state(inode, EXT4_STATE_JDATA);
+	} else if (!ret) {
+		if (ext4_should_order_data(inode))
+			ret = ext4_jbd2_file_inode(handle, inode);
+		if (!ret)
+			block_commit_write(page, 0, len);
+	}
+	if (ret && ext4_can_truncate(inode)) {
+		/* Same recovery as a failed ext4_write_begin(). */
+		ext4_orphan_add(handle, inode);
+		truncate = 1;
+	}
+out:
+	unlock_page(page);
+	page_cache_release(page);
+	ext4_journal_stop(handle);
+	if (truncate) {
+		ext4_truncate_failed_write(inode);
+		if (inode->i_nlink)
+			ext4_orphan_del(NULL, inode);
+	}
+	return ret;
+}
+
 /*
  * Reserve a single block located at lblock
  */
@@ -3177,6 +3300,19 @@ static int ext4_da_write_begin(struct file *file, struct address_space *mapping,
 		return ext4_write_begin(file, mapping, pos,
 					len, flags, pagep, fsdata);
 	}
+
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA) ||
+	    ext4_has_inline_data(inode)) {
+		ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+						    flags, pagep);
+		if (ret < 0)
+			return ret;
+		if (ret == 1) {
+			/* Nothing to delay: finish in ext4_generic_write_end() */
+			*fsdata = (void *)FALL_BACK_TO_NONDELALLOC;
+			return 0;
+		}
+	}
 	*fsdata = (void *)0;
 	trace_ext4_da_write_begin(inode, pos, len, flags);
 retry:
@@ -3397,6 +3533,10 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 	journal_t *journal;
 	int err;
 
+	/* Inline data has no block to report. */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	if (mapping_tagged(mapping, PAGECACHE_TAG_DIRTY) &&
 			test_opt(inode->i_sb, DELALLOC)) {
 		/*
@@ -3442,6 +3582,13 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 
 static int ext4_readpage(struct file *file, struct page *page)
 {
+	struct inode *inode = page->mapping->host;
+
+	if (ext4_has_inline_data(inode)) {
+		int ret = ext4_readpage_inline(inode, page);
+		if (ret != -EAGAIN)
+			return ret;
+	}
 	return mpage_readpage(page, ext4_get_block);
 }
 
@@ -3449,6 +3596,9 @@ static int
 ext4_readpages(struct file *file, struct address_space *mapping,
 		struct list_head *pages, unsigned nr_pages)
 {
+	/* Readahead is pointless for inline data: ->readpage does it. */
+	if (ext4_has_inline_data(mapping->host))
+		return 0;
 	return mpage_readpages(mapping, pages, nr_pages, ext4_get_block);
 }
 
@@ -3857,6 +4007,10 @@ static ssize_t ext4_direct_IO(int rw, struct kiocb *iocb,
 	struct file *file = iocb->ki_filp;
 	struct inode *inode = file->f_mapping->host;
 
+	/* Let the VFS fall back to buffered IO for inline data. */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
 		return ext4_ext_direct_IO(rw, iocb, iov, offset, nr_segs);
 
@@ -3970,10 +4124,24 @@ void ext4_set_aops(struct inode *inode)
  */
 int ext4_block_truncate_page(handle_t *handle,
 		struct address_space *mapping, loff_t from)
+{
+	unsigned blocksize = mapping->host->i_sb->s_blocksize;
+	unsigned length = blocksize - (from & (blocksize - 1));
+
+	return ext4_block_zero_page_range(handle, mapping, from, length);
+}
+
+/*
+ * ext4_block_zero_page_range() zeroes out a mapping of `length' bytes from
+ * file offset `from'.  The range is clipped to the end of the block that
+ * contains `from', so callers zero at most one partial block at a time.
+ */
+int ext4_block_zero_page_range(handle_t *handle,
+		struct address_space *mapping, loff_t from, loff_t length)
 {
 	ext4_fsblk_t index = from >> PAGE_CACHE_SHIFT;
 	unsigned offset = from & (PAGE_CACHE_SIZE-1);
-	unsigned blocksize, length, pos;
+	unsigned blocksize, max, pos;
 	ext4_lblk_t iblock;
 	struct inode *inode = mapping->host;
 	struct buffer_head *bh;
@@ -3986,7 +4154,9 @@ int ext4_block_truncate_page(handle_t *handle,
 		return -EINVAL;
 
 	blocksize = inode->i_sb->s_blocksize;
-	length = blocksize - (offset & (blocksize - 1));
+	max = blocksize - (offset & (blocksize - 1));
+	if (length > max)
+		length = max;
 	iblock = index << (PAGE_CACHE_SHIFT - inode->i_sb->s_blocksize_bits);
 
 	if (!page_has_buffers(page))
@@ -4039,7 +4209,7 @@ int ext4_block_truncate_page(handle_t *handle,
 
 	zero_user(page, offset, length);
 
-	BUFFER_TRACE(bh, "zeroed end of block");
+	BUFFER_TRACE(bh, "zeroed block range");
 
 	err = 0;
 	if (ext4_should_journal_data(inode)) {
@@ -4477,6 +4647,11 @@ void ext4_truncate(struct inode *inode)
 	if (inode->i_size == 0 && !test_opt(inode->i_sb, NO_AUTO_DA_ALLOC))
 		ext4_set_inode_state(inode, EXT4_STATE_DA_ALLOC_CLOSE);
 
+	if (ext4_has_inline_data(inode)) {
+		ext4_inline_data_truncate(inode);
+		return;
+	}
+
 	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		ext4_ext_truncate(inode);
 		return;
@@ -4966,6 +5141,21 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 				 ei->i_file_acl);
 		ret = -EIO;
 		goto bad_inode;
+	} else if (ext4_has_inline_data(inode)) {
+		/*
+		 * i_block holds file data or directory entries, not block
+		 * references.  Keep the in-inode attributes where they
+		 * are: moving them for extra_isize expansion would shift
+		 * system.data.
+		 */
+		if (!EXT4_HAS_INCOMPAT_FEATURE(sb,
+				EXT4_FEATURE_INCOMPAT_INLINE_DATA) ||
+		    !(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode))) {
+			EXT4_ERROR_INODE(inode, "unexpected inline data flag");
+			ret = -EIO;
+			goto bad_inode;
+		}
+		ext4_set_inode_state(inode, EXT4_STATE_NO_EXPAND);
 	} else if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		if (S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 		    (S_ISLNK(inode->i_mode) &&
@@ -5819,6 +6009,16 @@ int ext4_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf)
 	struct inode *inode = file->f_path.dentry->d_inode;
 	struct address_space *mapping = inode->i_mapping;
 
+	/*
+	 * Stores through a shared mapping never pass through write_end,
+	 * so mapped data has to live in blocks.
+	 */
+	if (ext4_test_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA) ||
+	    ext4_has_inline_data(inode)) {
+		if (ext4_convert_inline_data(inode))
+			return VM_FAULT_SIGBUS;
+	}
+
 	/*
 	 * Get i_alloc_sem to stop truncates messing with the inode. We cannot
 	 * get i_mutex because we are already holding mmap_sem.
@@ -234,6 +234,13 @@ setversion_out:
 		    !(filp->f_mode & FMODE_WRITE))
 			return -EBADF;
 
+		if (EXT4_HAS_RO_COMPAT_FEATURE(inode->i_sb,
+			       EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+			ext4_msg(inode->i_sb, KERN_ERR,
+				 "Online defrag not supported with bigalloc");
+			return -EOPNOTSUPP;
+		}
+
 		if (copy_from_user(&me,
 			(struct move_extent __user *)arg, sizeof(me)))
 			return -EFAULT;
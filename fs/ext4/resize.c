@@ -726,6 +726,11 @@ int ext4_group_add(struct super_block *sb, struct ext4_new_group_data *input)
 		return -EPERM;
 	}
 
+	if (EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+		ext4_warning(sb, "Online resizing not supported with bigalloc");
+		return -EOPNOTSUPP;
+	}
+
 	if (ext4_blocks_count(es) + input->blocks_count <
 	    ext4_blocks_count(es)) {
 		ext4_warning(sb, "blocks_count overflow");
@@ -956,6 +961,11 @@ int ext4_group_extend(struct super_block *sb, struct ext4_super_block *es,
 	if (n_blocks_count == 0 || n_blocks_count == o_blocks_count)
 		return 0;
 
+	if (EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+		ext4_warning(sb, "Online resizing not supported with bigalloc");
+		return -EOPNOTSUPP;
+	}
+
 	if (n_blocks_count > (sector_t)(~0ULL) >> (sb->s_blocksize_bits - 9)) {
 		printk(KERN_ERR "EXT4-fs: filesystem on %s:"
 			" too large to resize to %llu blocks safely\n",
@@ -2065,7 +2065,8 @@ static int ext4_check_descriptors(struct super_block *sb,
 	if (NULL != first_not_zeroed)
 		*first_not_zeroed = grp;
 
-	ext4_free_blocks_count_set(sbi->s_es, ext4_count_free_blocks(sb));
+	ext4_free_blocks_count_set(sbi->s_es,
+				   EXT4_C2B(sbi, ext4_count_free_blocks(sb)));
 	sbi->s_es->s_free_inodes_count =cpu_to_le32(ext4_count_free_inodes(sb));
 	return 1;
 }
@@ -2320,17 +2321,23 @@ static unsigned long ext4_get_stripe_size(struct ext4_sb_info *sbi)
 	unsigned long stride = le16_to_cpu(sbi->s_es->s_raid_stride);
 	unsigned long stripe_width =
 			le32_to_cpu(sbi->s_es->s_raid_stripe_width);
+	unsigned long ret = 0;
 
 	if (sbi->s_stripe && sbi->s_stripe <= sbi->s_blocks_per_group)
-		return sbi->s_stripe;
+		ret = sbi->s_stripe;
+	else if (stripe_width <= sbi->s_blocks_per_group)
+		ret = stripe_width;
+	else if (stride <= sbi->s_blocks_per_group)
+		ret = stride;
 
-	if (stripe_width <= sbi->s_blocks_per_group)
-		return stripe_width;
-
-	if (stride <= sbi->s_blocks_per_group)
-		return stride;
+	/*
+	 * The allocator works in clusters, so a stripe which isn't a
+	 * whole number of clusters can't be honoured.
+	 */
+	if (EXT4_LBLK_COFF(sbi, ret))
+		ret = 0;
 
-	return 0;
+	return ret;
 }
 
 /* sysfs supprt */
@@ -3257,12 +3264,59 @@ static int ext4_fill_super(struct super_block *sb, void *data, int silent)
 		sb->s_dirt = 1;
 	}
 
-	if (sbi->s_blocks_per_group > blocksize * 8) {
-		ext4_msg(sb, KERN_ERR,
-		       "#blocks per group too big: %lu",
-		       sbi->s_blocks_per_group);
-		goto failed_mount;
+	/* Handle clustersize */
+	if (EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC)) {
+		if (le32_to_cpu(es->s_log_cluster_size) <
+		    le32_to_cpu(es->s_log_block_size) ||
+		    le32_to_cpu(es->s_log_cluster_size) -
+		    le32_to_cpu(es->s_log_block_size) >= 32) {
+			ext4_msg(sb, KERN_ERR,
+				 "invalid cluster size (%u) for block size (%u)",
+				 le32_to_cpu(es->s_log_cluster_size),
+				 le32_to_cpu(es->s_log_block_size));
+			goto failed_mount;
+		}
+		sbi->s_cluster_bits = le32_to_cpu(es->s_log_cluster_size) -
+			le32_to_cpu(es->s_log_block_size);
+		sbi->s_clusters_per_group =
+			le32_to_cpu(es->s_clusters_per_group);
+		if (sbi->s_clusters_per_group > blocksize * 8) {
+			ext4_msg(sb, KERN_ERR,
+				 "#clusters per group too big: %lu",
+				 sbi->s_clusters_per_group);
+			goto failed_mount;
+		}
+		if (sbi->s_blocks_per_group !=
+		    ((u64) sbi->s_clusters_per_group << sbi->s_cluster_bits)) {
+			ext4_msg(sb, KERN_ERR, "blocks per group (%lu) and "
+				 "clusters per group (%lu) inconsistent",
+				 sbi->s_blocks_per_group,
+				 sbi->s_clusters_per_group);
+			goto failed_mount;
+		}
+		if (!EXT4_HAS_INCOMPAT_FEATURE(sb,
+					       EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+			ext4_msg(sb, KERN_ERR,
+				 "bigalloc requires the extents feature");
+			goto failed_mount;
+		}
+		if (le32_to_cpu(es->s_first_data_block) != 0) {
+			ext4_msg(sb, KERN_ERR,
+				 "bigalloc requires first data block 0");
+			goto failed_mount;
+		}
+	} else {
+		if (sbi->s_blocks_per_group > blocksize * 8) {
+			ext4_msg(sb, KERN_ERR,
+			       "#blocks per group too big: %lu",
+			       sbi->s_blocks_per_group);
+			goto failed_mount;
+		}
+		sbi->s_cluster_bits = 0;
+		sbi->s_clusters_per_group = sbi->s_blocks_per_group;
 	}
+	sbi->s_cluster_ratio = 1 << sbi->s_cluster_bits;
+
 	if (sbi->s_inodes_per_group > blocksize * 8) {
 		ext4_msg(sb, KERN_ERR,
 		       "#inodes per group too big: %lu",
@@ -3558,6 +3612,11 @@ no_journal:
 			 "requested data journaling mode");
 		clear_opt(sbi->s_mount_opt, DELALLOC);
 	}
+	if (test_opt(sb, DELALLOC) && sbi->s_cluster_ratio > 1) {
+		ext4_msg(sb, KERN_WARNING, "Ignoring delalloc option - "
+			 "not supported with bigalloc");
+		clear_opt(sbi->s_mount_opt, DELALLOC);
+	}
 	if (test_opt(sb, DIOREAD_NOLOCK)) {
 		if (test_opt(sb, DATA_FLAGS) == EXT4_MOUNT_JOURNAL_DATA) {
 			ext4_msg(sb, KERN_WARNING, "Ignoring dioread_nolock "
@@ -3982,8 +4041,9 @@ static int ext4_commit_super(struct super_block *sb, int sync)
 	else
 		es->s_kbytes_written =
 			cpu_to_le64(EXT4_SB(sb)->s_kbytes_written);
-	ext4_free_blocks_count_set(es, percpu_counter_sum_positive(
-					   &EXT4_SB(sb)->s_freeblocks_counter));
+	ext4_free_blocks_count_set(es,
+			EXT4_C2B(EXT4_SB(sb), percpu_counter_sum_positive(
+				&EXT4_SB(sb)->s_freeblocks_counter)));
 	es->s_free_inodes_count =
 		cpu_to_le32(percpu_counter_sum_positive(
 				&EXT4_SB(sb)->s_freeinodes_counter));
@@ -4208,6 +4268,12 @@ static int ext4_remount(struct super_block *sb, int *flags, char *data)
 		goto restore_opts;
 	}
 
+	if (test_opt(sb, DELALLOC) && sbi->s_cluster_ratio > 1) {
+		ext4_msg(sb, KERN_WARNING, "Ignoring delalloc option - "
+			 "not supported with bigalloc");
+		clear_opt(sbi->s_mount_opt, DELALLOC);
+	}
+
 	if (sbi->s_mount_flags & EXT4_MF_FS_ABORTED)
 		ext4_abort(sb, "Abort forced by user");
 
@@ -4407,8 +4473,9 @@ static int ext4_statfs(struct dentry *dentry, struct kstatfs *buf)
 	buf->f_type = EXT4_SUPER_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = ext4_blocks_count(es) - sbi->s_overhead_last;
-	buf->f_bfree = percpu_counter_sum_positive(&sbi->s_freeblocks_counter) -
-		       percpu_counter_sum_positive(&sbi->s_dirtyblocks_counter);
+	buf->f_bfree = EXT4_C2B(sbi,
+		percpu_counter_sum_positive(&sbi->s_freeblocks_counter) -
+		percpu_counter_sum_positive(&sbi->s_dirtyblocks_counter));
 	buf->f_bavail = buf->f_bfree - ext4_r_blocks_count(es);
 	if (buf->f_bfree < ext4_r_blocks_count(es))
 		buf->f_bavail = 0;
@@ -25,15 +25,74 @@ MODULE_ALIAS("devname:fuse");
 
 static struct kmem_cache *fuse_req_cachep;
 
-static struct fuse_conn *fuse_get_conn(struct file *file)
+static struct fuse_chan *fuse_get_chan(struct file *file)
 {
 	/*
 	 * Lockless access is OK, because file->private data is set
-	 * once during mount and is valid until the file is released.
+	 * once during mount or cloning and is valid until the file is
+	 * released.
 	 */
 	return file->private_data;
 }
 
+static struct fuse_conn *fuse_get_conn(struct file *file)
+{
+	struct fuse_chan *ch = fuse_get_chan(file);
+
+	return ch ? ch->fc : NULL;
+}
+
+void fuse_chan_init(struct fuse_chan *ch, struct fuse_conn *fc)
+{
+	ch->fc = fc;
+	init_waitqueue_head(&ch->waitq);
+	INIT_LIST_HEAD(&ch->pending);
+	INIT_LIST_HEAD(&ch->processing);
+	INIT_LIST_HEAD(&ch->interrupts);
+	ch->fasync = NULL;
+}
+EXPORT_SYMBOL_GPL(fuse_chan_init);
+
+/* Called with fc->lock held */
+static struct fuse_chan *fuse_chan_nr(struct fuse_conn *fc, unsigned i)
+{
+	return fc->chans ? fc->chans[i] : &fc->chan;
+}
+
+/*
+ * Pick the channel of the current CPU, so that daemon threads serving
+ * different channels don't wake each other up.
+ *
+ * Called with fc->lock held
+ */
+static struct fuse_chan *fuse_route_chan(struct fuse_conn *fc)
+{
+	if (fc->num_chans == 1)
+		return &fc->chan;
+
+	return fc->chans[raw_smp_processor_id() % fc->num_chans];
+}
+
+static void fuse_chan_wake(struct fuse_chan *ch)
+{
+	wake_up(&ch->waitq);
+	kill_fasync(&ch->fasync, SIGIO, POLL_IN);
+}
+
+/* Called with fc->lock held */
+void fuse_chan_wake_all(struct fuse_conn *fc)
+{
+	unsigned i;
+
+	for (i = 0; i < fc->num_chans; i++) {
+		struct fuse_chan *ch = fuse_chan_nr(fc, i);
+
+		wake_up_all(&ch->waitq);
+		kill_fasync(&ch->fasync, SIGIO, POLL_IN);
+	}
+}
+EXPORT_SYMBOL_GPL(fuse_chan_wake_all);
+
 static void fuse_request_init(struct fuse_req *req)
 {
 	memset(req, 0, sizeof(*req));
@@ -239,16 +298,17 @@ static u64 fuse_get_unique(struct fuse_conn *fc)
 
 static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
 {
+	struct fuse_chan *ch = fuse_route_chan(fc);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
+	list_add_tail(&req->list, &ch->pending);
 	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	fuse_chan_wake(ch);
 }
 
 static void flush_bg_queue(struct fuse_conn *fc)
@@ -317,11 +377,11 @@ __acquires(fc->lock)
 	spin_lock(&fc->lock);
 }
 
+/* The interrupt goes to the channel which is processing the request */
 static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 {
-	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	list_add_tail(&req->intr_entry, &req->chan->interrupts);
+	fuse_chan_wake(req->chan);
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
@@ -896,20 +956,20 @@ static int fuse_copy_args(struct fuse_copy_state *cs, unsigned numargs,
 	return err;
 }
 
-static int request_pending(struct fuse_conn *fc)
+static int request_pending(struct fuse_chan *ch)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts);
+	return !list_empty(&ch->pending) || !list_empty(&ch->interrupts);
 }
 
 /* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
+static void request_wait(struct fuse_conn *fc, struct fuse_chan *ch)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
 	DECLARE_WAITQUEUE(wait, current);
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
+	add_wait_queue_exclusive(&ch->waitq, &wait);
+	while (fc->connected && !request_pending(ch)) {
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (signal_pending(current))
 			break;
@@ -919,7 +979,7 @@ __acquires(fc->lock)
 		spin_lock(&fc->lock);
 	}
 	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+	remove_wait_queue(&ch->waitq, &wait);
 }
 
 /*
@@ -969,9 +1029,10 @@ __releases(fc->lock)
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_chan *ch, struct file *file,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = ch->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
@@ -981,25 +1042,26 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 	spin_lock(&fc->lock);
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
+	    !request_pending(ch))
 		goto err_unlock;
 
-	request_wait(fc);
+	request_wait(fc, ch);
 	err = -ENODEV;
 	if (!fc->connected)
 		goto err_unlock;
 	err = -ERESTARTSYS;
-	if (!request_pending(fc))
+	if (!request_pending(ch))
 		goto err_unlock;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
+	if (!list_empty(&ch->interrupts)) {
+		req = list_entry(ch->interrupts.next, struct fuse_req,
 				 intr_entry);
 		return fuse_read_interrupt(fc, cs, nbytes, req);
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
+	req = list_entry(ch->pending.next, struct fuse_req, list);
 	req->state = FUSE_REQ_READING;
+	req->chan = ch;
 	list_move(&req->list, &fc->io);
 
 	in = &req->in;
@@ -1035,7 +1097,7 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		request_end(fc, req);
 	else {
 		req->state = FUSE_REQ_SENT;
-		list_move_tail(&req->list, &fc->processing);
+		list_move_tail(&req->list, &ch->processing);
 		if (req->interrupted)
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
@@ -1052,13 +1114,13 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
 {
 	struct fuse_copy_state cs;
 	struct file *file = iocb->ki_filp;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 1, iov, nr_segs);
+	fuse_copy_init(&cs, ch->fc, 1, iov, nr_segs);
 
-	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_read(ch, file, &cs, iov_length(iov, nr_segs));
 }
 
 static int fuse_dev_pipe_buf_steal(struct pipe_inode_info *pipe,
@@ -1086,18 +1148,18 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int do_wakeup = 0;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(in);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(in);
+	if (!ch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof (struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
-	fuse_copy_init(&cs, fc, 1, NULL, 0);
+	fuse_copy_init(&cs, ch->fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fc, in, &cs, len);
+	ret = fuse_dev_do_read(ch, in, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -1461,11 +1523,11 @@ static int fuse_notify(struct fuse_conn *fc, enum fuse_notify_code code,
 }
 
 /* Look up request on processing list by unique ID */
-static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
+static struct fuse_req *request_find(struct fuse_chan *ch, u64 unique)
 {
 	struct list_head *entry;
 
-	list_for_each(entry, &fc->processing) {
+	list_for_each(entry, &ch->processing) {
 		struct fuse_req *req;
 		req = list_entry(entry, struct fuse_req, list);
 		if (req->in.h.unique == unique || req->intr_unique == unique)
@@ -1504,9 +1566,10 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+static ssize_t fuse_dev_do_write(struct fuse_chan *ch,
 				 struct fuse_copy_state *cs, size_t nbytes)
 {
+	struct fuse_conn *fc = ch->fc;
 	int err;
 	struct fuse_req *req;
 	struct fuse_out_header oh;
@@ -1540,7 +1603,7 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	if (!fc->connected)
 		goto err_unlock;
 
-	req = request_find(fc, oh.unique);
+	req = request_find(ch, oh.unique);
 	if (!req)
 		goto err_unlock;
 
@@ -1601,13 +1664,13 @@ static ssize_t fuse_dev_write(struct kiocb *iocb, const struct iovec *iov,
 			      unsigned long nr_segs, loff_t pos)
 {
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(iocb->ki_filp);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(iocb->ki_filp);
+	if (!ch)
 		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, iov, nr_segs);
+	fuse_copy_init(&cs, ch->fc, 0, iov, nr_segs);
 
-	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+	return fuse_dev_do_write(ch, &cs, iov_length(iov, nr_segs));
 }
 
 static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
@@ -1618,12 +1681,12 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	unsigned idx;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
-	struct fuse_conn *fc;
+	struct fuse_chan *ch;
 	size_t rem;
 	ssize_t ret;
 
-	fc = fuse_get_conn(out);
-	if (!fc)
+	ch = fuse_get_chan(out);
+	if (!ch)
 		return -EPERM;
 
 	bufs = kmalloc(pipe->buffers * sizeof (struct pipe_buffer), GFP_KERNEL);
@@ -1670,14 +1733,14 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	}
 	pipe_unlock(pipe);
 
-	fuse_copy_init(&cs, fc, 0, NULL, nbuf);
+	fuse_copy_init(&cs, ch->fc, 0, NULL, nbuf);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
 
 	if (flags & SPLICE_F_MOVE)
 		cs.move_pages = 1;
 
-	ret = fuse_dev_do_write(fc, &cs, len);
+	ret = fuse_dev_do_write(ch, &cs, len);
 
 	for (idx = 0; idx < nbuf; idx++) {
 		struct pipe_buffer *buf = &bufs[idx];
@@ -1691,16 +1754,18 @@ out:
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	struct fuse_conn *fc;
+	if (!ch)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	fc = ch->fc;
+	poll_wait(file, &ch->waitq, wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(ch))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
@@ -1766,10 +1831,22 @@ static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	LIST_HEAD(head);
+	unsigned i;
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
-	end_requests(fc, &fc->processing);
+	/*
+	 * Collect the requests first: end_requests() drops the lock, and
+	 * a cloned channel may go away meanwhile
+	 */
+	for (i = 0; i < fc->num_chans; i++) {
+		struct fuse_chan *ch = fuse_chan_nr(fc, i);
+
+		list_splice_tail_init(&ch->pending, &head);
+		list_splice_tail_init(&ch->processing, &head);
+	}
+	end_requests(fc, &head);
 }
 
 /*
@@ -1799,22 +1876,73 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		fc->blocked = 0;
 		end_io_requests(fc);
 		end_queued_requests(fc);
-		wake_up_all(&fc->waitq);
+		fuse_chan_wake_all(fc);
 		wake_up_all(&fc->blocked_waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
 	spin_unlock(&fc->lock);
 }
 EXPORT_SYMBOL_GPL(fuse_abort_conn);
 
+/*
+ * Detach a cloned channel from the connection.
+ *
+ * Requests not yet read are handed over to the main channel, requests
+ * being processed are aborted, since their reply can only come on this
+ * channel.
+ */
+static void fuse_chan_release(struct fuse_chan *ch)
+{
+	struct fuse_conn *fc = ch->fc;
+	struct fuse_chan **tab = NULL;
+	LIST_HEAD(head);
+	unsigned i;
+
+	mutex_lock(&fuse_mutex);
+	spin_lock(&fc->lock);
+	for (i = 0; fc->chans[i] != ch; i++)
+		;
+	memmove(&fc->chans[i], &fc->chans[i + 1],
+		(fc->num_chans - i - 1) * sizeof(fc->chans[0]));
+	fc->num_chans--;
+	if (fc->num_chans == 1) {
+		tab = fc->chans;
+		fc->chans = NULL;
+	}
+
+	if (fc->connected && !list_empty(&ch->pending)) {
+		list_splice_tail_init(&ch->pending, &fc->chan.pending);
+		fuse_chan_wake(&fc->chan);
+	}
+	list_splice_tail_init(&ch->pending, &head);
+	list_splice_tail_init(&ch->processing, &head);
+	spin_unlock(&fc->lock);
+	mutex_unlock(&fuse_mutex);
+	kfree(tab);
+
+	spin_lock(&fc->lock);
+	end_requests(fc, &head);
+	spin_unlock(&fc->lock);
+}
+
 int fuse_dev_release(struct inode *inode, struct file *file)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (fc) {
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (ch) {
+		struct fuse_conn *fc = ch->fc;
+
+		if (ch != &fc->chan) {
+			fuse_chan_release(ch);
+			kfree(ch);
+			fuse_conn_put(fc);
+			return 0;
+		}
+
 		spin_lock(&fc->lock);
 		fc->connected = 0;
 		fc->blocked = 0;
 		end_queued_requests(fc);
+		/* Readers of cloned channels get -ENODEV */
+		fuse_chan_wake_all(fc);
 		wake_up_all(&fc->blocked_waitq);
 		spin_unlock(&fc->lock);
 		fuse_conn_put(fc);
@@ -1826,12 +1954,87 @@ EXPORT_SYMBOL_GPL(fuse_dev_release);
 
 static int fuse_dev_fasync(int fd, struct file *file, int on)
 {
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
+	struct fuse_chan *ch = fuse_get_chan(file);
+	if (!ch)
 		return -EPERM;
 
 	/* No locking - fasync_helper does its own locking */
-	return fasync_helper(fd, file, on, &fc->fasync);
+	return fasync_helper(fd, file, on, &ch->fasync);
+}
+
+/*
+ * Attach the still unused device file @file to the connection of @old
+ * as a new channel
+ */
+static int fuse_dev_clone(struct file *file, struct file *old)
+{
+	struct fuse_chan *ch;
+	struct fuse_chan **tab;
+	struct fuse_chan **old_tab;
+	struct fuse_conn *fc;
+	unsigned i;
+	int err;
+
+	ch = kmalloc(sizeof(*ch), GFP_KERNEL);
+	if (!ch)
+		return -ENOMEM;
+
+	mutex_lock(&fuse_mutex);
+	err = -EINVAL;
+	fc = fuse_get_conn(old);
+	if (!fc || file->private_data)
+		goto err_unlock;
+
+	/* The table only changes under fuse_mutex, so num_chans is stable */
+	err = -ENOMEM;
+	tab = kmalloc((fc->num_chans + 1) * sizeof(tab[0]), GFP_KERNEL);
+	if (!tab)
+		goto err_unlock;
+
+	fuse_chan_init(ch, fuse_conn_get(fc));
+	spin_lock(&fc->lock);
+	for (i = 0; i < fc->num_chans; i++)
+		tab[i] = fuse_chan_nr(fc, i);
+	tab[i] = ch;
+	old_tab = fc->chans;
+	fc->chans = tab;
+	fc->num_chans++;
+	spin_unlock(&fc->lock);
+	file->private_data = ch;
+	mutex_unlock(&fuse_mutex);
+
+	kfree(old_tab);
+	return 0;
+
+ err_unlock:
+	mutex_unlock(&fuse_mutex);
+	kfree(ch);
+	return err;
+}
+
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct file *old;
+	__u32 oldfd;
+	int err;
+
+	if (cmd != FUSE_DEV_IOC_CLONE)
+		return -ENOTTY;
+
+	if (get_user(oldfd, (__u32 __user *) arg))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EINVAL;
+
+	err = -EINVAL;
+	if (old->f_op == file->f_op)
+		err = fuse_dev_clone(file, old);
+	fput(old);
+
+	return err;
 }
 
 const struct file_operations fuse_dev_operations = {
@@ -1846,6 +2049,8 @@ const struct file_operations fuse_dev_operations = {
 	.poll		= fuse_dev_poll,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+	.compat_ioctl	= fuse_dev_ioctl,
 };
 EXPORT_SYMBOL_GPL(fuse_dev_operations);
 
@@ -201,13 +201,16 @@ enum fuse_req_state {
  * A request to the client
  */
 struct fuse_req {
-	/** This can be on either pending processing or io lists in
-	    fuse_conn */
+	/** This can be on either pending or processing lists in
+	    fuse_chan, or on the io list in fuse_conn */
 	struct list_head list;
 
 	/** Entry on the interrupts list  */
 	struct list_head intr_entry;
 
+	/** Channel the request was read from */
+	struct fuse_chan *chan;
+
 	/** refcount */
 	atomic_t count;
 
@@ -301,6 +304,37 @@ struct fuse_req {
 	struct file *stolen_file;
 };
 
+/**
+ * A channel of a fuse connection.
+ *
+ * Every open /dev/fuse file attached to a connection has a channel.
+ * The file used at mount time owns the channel embedded in the
+ * connection, further ones are added with FUSE_DEV_IOC_CLONE.  New
+ * requests are queued on the channel of the submitting CPU, and the
+ * reply must arrive on the channel the request was read from.
+ *
+ * All lists are protected by fc->lock.
+ */
+struct fuse_chan {
+	/** The connection this channel belongs to */
+	struct fuse_conn *fc;
+
+	/** Readers of the channel are waiting on this */
+	wait_queue_head_t waitq;
+
+	/** The list of pending requests */
+	struct list_head pending;
+
+	/** The list of requests being processed */
+	struct list_head processing;
+
+	/** Pending interrupts */
+	struct list_head interrupts;
+
+	/** O_ASYNC requests */
+	struct fasync_struct *fasync;
+};
+
 /**
  * A Fuse connection.
  *
@@ -333,14 +367,14 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
+	/** Channel of the device file used at mount time */
+	struct fuse_chan chan;
 
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Cloned channel table, NULL if there's only the main channel */
+	struct fuse_chan **chans;
 
-	/** The list of requests being processed */
-	struct list_head processing;
+	/** Number of channels, including the main one */
+	unsigned num_chans;
 
 	/** The list of requests under I/O */
 	struct list_head io;
@@ -366,9 +400,6 @@ struct fuse_conn {
 	/** The list of background requests set aside for later queuing */
 	struct list_head bg_queue;
 
-	/** Pending interrupts */
-	struct list_head interrupts;
-
 	/** Flag indicating if connection is blocked.  This will be
 	    the case before the INIT reply is received, and if there
 	    are too many outstading backgrounds requests */
@@ -457,6 +488,9 @@ struct fuse_conn {
 	/** Don't apply umask to creation modes */
 	unsigned dont_mask:1;
 
+	/** Buffered writes go through the page cache and writeback */
+	unsigned writeback_cache:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -478,9 +512,6 @@ struct fuse_conn {
 	/** number of dentries used in the above array */
 	int ctl_ndents;
 
-	/** O_ASYNC requests */
-	struct fasync_struct *fasync;
-
 	/** Key for lock owner ID scrambling */
 	u32 scramble_key[4];
 
@@ -520,6 +551,21 @@ static inline u64 get_node_id(struct inode *inode)
 	return get_fuse_inode(inode)->nodeid;
 }
 
+/*
+ * Open flags as sent to userspace.  In writeback cache mode the kernel
+ * reads in pages around partial writes and places appends itself, so
+ * the file handle must be readable and must not append.
+ */
+static inline int fuse_open_flags(struct fuse_conn *fc, int flags)
+{
+	if (fc->writeback_cache) {
+		if ((flags & O_ACCMODE) == O_WRONLY)
+			flags = (flags & ~O_ACCMODE) | O_RDWR;
+		flags &= ~O_APPEND;
+	}
+	return flags;
+}
+
 /** Device operations */
 extern const struct file_operations fuse_dev_operations;
 
@@ -749,6 +795,18 @@ long fuse_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg,
 unsigned fuse_file_poll(struct file *file, poll_table *wait);
 int fuse_dev_release(struct inode *inode, struct file *file);
 
+/**
+ * Initialize a device channel of the connection
+ */
+void fuse_chan_init(struct fuse_chan *ch, struct fuse_conn *fc);
+
+/**
+ * Wake up readers on all channels of the connection
+ */
+void fuse_chan_wake_all(struct fuse_conn *fc);
+
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
+int fuse_flush_mtime(struct inode *inode);
+
 #endif /* _FS_FUSE_I_H */
@@ -438,6 +438,11 @@ static void evict(struct inode *inode)
 {
 	const struct super_operations *op = inode->i_sb->s_op;
 
+	/*
+	 * Stop reclaim from leaving shadow entries behind in the page
+	 * cache from here on, see mm/workingset.c.
+	 */
+	mapping_set_exiting(&inode->i_data);
 	if (op->evict_inode) {
 		op->evict_inode(inode);
 	} else {
@@ -445,6 +450,12 @@ static void evict(struct inode *inode)
 			truncate_inode_pages(&inode->i_data, 0);
 		end_writeback(inode);
 	}
+	/*
+	 * Not every ->evict_inode() truncates an inode without pages,
+	 * drop the shadow entries that may still pin radix tree nodes.
+	 */
+	if (inode->i_data.nrshadows)
+		truncate_inode_pages(&inode->i_data, 0);
 	if (S_ISBLK(inode->i_mode) && inode->i_bdev)
 		bd_forget(inode);
 	if (S_ISCHR(inode->i_mode) && inode->i_cdev)
@@ -960,20 +960,25 @@ restart_loop:
 	commit_transaction->t_start = jiffies;
 	stats.run.rs_logging = jbd2_time_diff(stats.run.rs_logging,
 					      commit_transaction->t_start);
+	commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
 
 	/*
 	 * File the transaction statistics
 	 */
 	stats.ts_tid = commit_transaction->t_tid;
+	stats.ts_commit_time = commit_time;
 	stats.run.rs_handle_count =
 		atomic_read(&commit_transaction->t_handle_count);
 	trace_jbd2_run_stats(journal->j_fs_dev->bd_dev,
 			     commit_transaction->t_tid, &stats.run);
 
 	/*
-	 * Calculate overall stats
+	 * Calculate overall stats and record this commit in the history
 	 */
 	spin_lock(&journal->j_history_lock);
+	journal->j_history[journal->j_history_cur++] = stats;
+	if (journal->j_history_cur == journal->j_history_max)
+		journal->j_history_cur = 0;
 	journal->j_stats.ts_tid++;
 	journal->j_stats.run.rs_wait += stats.run.rs_wait;
 	journal->j_stats.run.rs_running += stats.run.rs_running;
@@ -989,7 +994,6 @@ restart_loop:
 	J_ASSERT(commit_transaction == journal->j_committing_transaction);
 	journal->j_commit_sequence = commit_transaction->t_tid;
 	journal->j_committing_transaction = NULL;
-	commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
 
 	/*
 	 * weight the commit time higher than the average time so we don't
@@ -498,6 +498,16 @@ int jbd2_log_start_commit(journal_t *journal, tid_t tid)
 {
 	int ret;
 
+	/*
+	 * fsync-heavy workloads mostly ask for a commit which is already
+	 * requested, so check that under the shared lock first.
+	 */
+	read_lock(&journal->j_state_lock);
+	ret = tid_geq(journal->j_commit_request, tid);
+	read_unlock(&journal->j_state_lock);
+	if (ret)
+		return 0;
+
 	write_lock(&journal->j_state_lock);
 	ret = __jbd2_log_start_commit(journal, tid);
 	write_unlock(&journal->j_state_lock);
@@ -794,6 +804,112 @@ static const struct file_operations jbd2_seq_info_fops = {
 	.release        = jbd2_seq_info_release,
 };
 
+/*
+ * The history file lists the statistics of the most recent commits,
+ * oldest first.  s->stats holds a snapshot of the history in commit
+ * order and s->max is the number of valid entries in it.
+ */
+static void *jbd2_seq_history_start(struct seq_file *seq, loff_t *pos)
+{
+	struct jbd2_stats_proc_session *s = seq->private;
+
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	if (*pos > s->max)
+		return NULL;
+	return s->stats + *pos - 1;
+}
+
+static void *jbd2_seq_history_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	++*pos;
+	return jbd2_seq_history_start(seq, pos);
+}
+
+static int jbd2_seq_history_show(struct seq_file *seq, void *v)
+{
+	struct transaction_stats_s *ts = v;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(seq, "%-10s %-5s %-5s %-5s %-5s %-5s %-6s %-5s "
+			   "%-5s %-8s\n", "tid", "wait", "run", "lock",
+			   "flush", "log", "hndls", "block", "inlog",
+			   "commit");
+		return 0;
+	}
+	seq_printf(seq, "%-10lu %-5u %-5u %-5u %-5u %-5u %-6u %-5u %-5u "
+		   "%-8llu\n", ts->ts_tid,
+		   jiffies_to_msecs(ts->run.rs_wait),
+		   jiffies_to_msecs(ts->run.rs_running),
+		   jiffies_to_msecs(ts->run.rs_locked),
+		   jiffies_to_msecs(ts->run.rs_flushing),
+		   jiffies_to_msecs(ts->run.rs_logging),
+		   ts->run.rs_handle_count, ts->run.rs_blocks,
+		   ts->run.rs_blocks_logged,
+		   div_u64(ts->ts_commit_time, 1000));
+	return 0;
+}
+
+static void jbd2_seq_history_stop(struct seq_file *seq, void *v)
+{
+}
+
+static const struct seq_operations jbd2_seq_history_ops = {
+	.start  = jbd2_seq_history_start,
+	.next   = jbd2_seq_history_next,
+	.stop   = jbd2_seq_history_stop,
+	.show   = jbd2_seq_history_show,
+};
+
+static int jbd2_seq_history_open(struct inode *inode, struct file *file)
+{
+	journal_t *journal = PDE(inode)->data;
+	struct jbd2_stats_proc_session *s;
+	int rc, size, first, n;
+
+	s = kmalloc(sizeof(*s), GFP_KERNEL);
+	if (s == NULL)
+		return -ENOMEM;
+	size = sizeof(struct transaction_stats_s) * journal->j_history_max;
+	s->stats = kmalloc(size, GFP_KERNEL);
+	if (s->stats == NULL) {
+		kfree(s);
+		return -ENOMEM;
+	}
+	spin_lock(&journal->j_history_lock);
+	/* j_stats.ts_tid counts the commits filed so far */
+	s->max = min_t(unsigned long, journal->j_stats.ts_tid,
+		       journal->j_history_max);
+	s->start = 0;
+	first = journal->j_history_cur - s->max;
+	if (first < 0)
+		first += journal->j_history_max;
+	n = min(s->max, journal->j_history_max - first);
+	memcpy(s->stats, journal->j_history + first, n * sizeof(*s->stats));
+	memcpy(s->stats + n, journal->j_history,
+	       (s->max - n) * sizeof(*s->stats));
+	s->journal = journal;
+	spin_unlock(&journal->j_history_lock);
+
+	rc = seq_open(file, &jbd2_seq_history_ops);
+	if (rc == 0) {
+		struct seq_file *m = file->private_data;
+		m->private = s;
+	} else {
+		kfree(s->stats);
+		kfree(s);
+	}
+	return rc;
+}
+
+static const struct file_operations jbd2_seq_history_fops = {
+	.owner		= THIS_MODULE,
+	.open           = jbd2_seq_history_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = jbd2_seq_info_release,
+};
+
 static struct proc_dir_entry *proc_jbd2_stats;
 
 static void jbd2_stats_proc_init(journal_t *journal)
@@ -802,12 +918,15 @@ static void jbd2_stats_proc_init(journal_t *journal)
 	if (journal->j_proc_entry) {
 		proc_create_data("info", S_IRUGO, journal->j_proc_entry,
 				 &jbd2_seq_info_fops, journal);
+		proc_create_data("history", S_IRUGO, journal->j_proc_entry,
+				 &jbd2_seq_history_fops, journal);
 	}
 }
 
 static void jbd2_stats_proc_exit(journal_t *journal)
 {
 	remove_proc_entry("info", journal->j_proc_entry);
+	remove_proc_entry("history", journal->j_proc_entry);
 	remove_proc_entry(journal->j_devname, proc_jbd2_stats);
 }
 
@@ -856,6 +975,15 @@ static journal_t * journal_init_common (void)
 	}
 
 	spin_lock_init(&journal->j_history_lock);
+	journal->j_history = kcalloc(JBD2_HISTORY_SIZE,
+				     sizeof(struct transaction_stats_s),
+				     GFP_KERNEL);
+	if (!journal->j_history) {
+		jbd2_journal_destroy_revoke(journal);
+		kfree(journal);
+		goto fail;
+	}
+	journal->j_history_max = JBD2_HISTORY_SIZE;
 
 	return journal;
 fail:
@@ -931,6 +1059,7 @@ journal_t * jbd2_journal_init_dev(struct block_device *bdev,
 out_err:
 	kfree(journal->j_wbuf);
 	jbd2_stats_proc_exit(journal);
+	kfree(journal->j_history);
 	kfree(journal);
 	return NULL;
 }
@@ -1005,6 +1134,7 @@ journal_t * jbd2_journal_init_inode (struct inode *inode)
 out_err:
 	kfree(journal->j_wbuf);
 	jbd2_stats_proc_exit(journal);
+	kfree(journal->j_history);
 	kfree(journal);
 	return NULL;
 }
@@ -1349,6 +1479,7 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_revoke)
 		jbd2_journal_destroy_revoke(journal);
 	kfree(journal->j_wbuf);
+	kfree(journal->j_history);
 	kfree(journal);
 
 	return err;
@@ -595,6 +595,20 @@ do_get_write_access(handle_t *handle, struct journal_head *jh,
 repeat:
 	bh = jh2bh(jh);
 
+	/*
+	 * Fastpath: if the buffer is already part of the running
+	 * transaction and nobody dirtied it behind our back, there is
+	 * nothing to do and no need to wait for the buffer lock, which
+	 * may be held for writeout by checkpointing.  Neither test can
+	 * turn true under us, and a stale answer just takes the slow path.
+	 */
+	if (!buffer_dirty(bh) && (jh->b_transaction == transaction ||
+				  jh->b_next_transaction == transaction)) {
+		JBUFFER_TRACE(jh, "fastpath");
+		error = 0;
+		goto cancel_revoke;
+	}
+
 	/* @@@ Need to check for errors here at some point. */
 
 	lock_buffer(bh);
@@ -790,6 +804,7 @@ done:
 	}
 	jbd_unlock_bh_state(bh);
 
+cancel_revoke:
 	/*
 	 * If we are about to journal a buffer, then any revoke pending on it is
 	 * no longer valid
@@ -264,6 +264,27 @@ static inline void ptep_modify_prot_commit(struct mm_struct *mm,
 	__ptep_modify_prot_commit(mm, addr, ptep, pte);
 }
 #endif /* __HAVE_ARCH_PTEP_MODIFY_PROT_TRANSACTION */
+
+#ifndef CONFIG_NUMA_BALANCING
+/*
+ * Architectures that support NUMA balancing provide pte_numa() and
+ * friends; without it no pte is ever a NUMA hinting pte.
+ */
+static inline int pte_numa(pte_t pte)
+{
+	return 0;
+}
+
+static inline pte_t pte_mknuma(pte_t pte)
+{
+	return pte;
+}
+
+static inline pte_t pte_mknonnuma(pte_t pte)
+{
+	return pte;
+}
+#endif
 #endif /* CONFIG_MMU */
 
 /*
@@ -659,6 +659,7 @@ struct transaction_run_stats_s {
 
 struct transaction_stats_s {
 	unsigned long		ts_tid;
+	u64			ts_commit_time;	/* in nanoseconds */
 	struct transaction_run_stats_s run;
 };
 
@@ -673,6 +674,8 @@ jbd2_time_diff(unsigned long start, unsigned long end)
 
 #define JBD2_NR_BATCH	64
 
+#define JBD2_HISTORY_SIZE	100
+
 /**
  * struct journal_s - The journal_s type is the concrete type associated with
  *     journal_t.
@@ -965,6 +968,9 @@ struct journal_s
 	/*
 	 * Journal statistics
 	 */
+	struct transaction_stats_s *j_history;
+	int			j_history_max;
+	int			j_history_cur;
 	spinlock_t		j_history_lock;
 	struct proc_dir_entry	*j_proc_entry;
 	struct transaction_stats_s j_stats;
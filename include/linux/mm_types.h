@@ -40,9 +40,13 @@ struct page {
 					 * to show when page is mapped
 					 * & limit reverse map searches.
 					 */
+		unsigned counters;	/* SLUB: inuse, objects and frozen
+					 * as one word for cmpxchg_double_slab
+					 */
 		struct {		/* SLUB */
-			u16 inuse;
-			u16 objects;
+			unsigned inuse:16;
+			unsigned objects:15;
+			unsigned frozen:1;
 		};
 	};
 	union {
@@ -72,9 +76,21 @@ struct page {
 		pgoff_t index;		/* Our offset within mapping. */
 		void *freelist;		/* SLUB: freelist req. slab lock */
 	};
-	struct list_head lru;		/* Pageout list, eg. active_list
+	union {
+		struct list_head lru;	/* Pageout list, eg. active_list
 					 * protected by zone->lru_lock !
 					 */
+		struct {		/* SLUB per cpu partial pages */
+			struct page *next;	/* Next partial slab */
+#ifdef CONFIG_64BIT
+			int pages;	/* Nr of partial slabs left */
+			int pobjects;	/* Approximate # of objects */
+#else
+			short int pages;
+			short int pobjects;
+#endif
+		};
+	};
 	/*
 	 * On machines where all RAM is mapped into kernel address space,
 	 * we can simply calculate the virtual address. On machines with
@@ -312,8 +328,24 @@ struct mm_struct {
 #endif
 	/* How many tasks sharing this mm are OOM_DISABLE */
 	atomic_t oom_disable_count;
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * numa_next_scan is the jiffy after which the next pte scan may
+	 * start, numa_scan_offset where it resumes.  numa_scan_seq counts
+	 * completed passes over the address space.  first_nid is the node
+	 * the mm was first scanned from, or NUMA_PTE_SCAN_ACTIVE once one
+	 * of its tasks ran on another node.
+	 */
+	unsigned long numa_next_scan;
+	unsigned long numa_scan_offset;
+	int numa_scan_seq;
+	int first_nid;
+#endif
 };
 
+#define NUMA_PTE_SCAN_INIT	-1
+#define NUMA_PTE_SCAN_ACTIVE	-2
+
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
 #define mm_cpumask(mm) (&(mm)->cpu_vm_mask)
 
@@ -8,8 +8,8 @@
 #ifndef _LINUX_PAGEVEC_H
 #define _LINUX_PAGEVEC_H
 
-/* 14 pointers + two long's align the pagevec structure to a power of two */
-#define PAGEVEC_SIZE	14
+/* 30 pointers + two long's align the pagevec structure to a power of two */
+#define PAGEVEC_SIZE	30
 
 struct page;
 struct address_space;
@@ -8,6 +8,7 @@
 #include <linux/memcontrol.h>
 #include <linux/sched.h>
 #include <linux/node.h>
+#include <linux/workqueue.h>
 
 #include <asm/atomic.h>
 #include <asm/page.h>
@@ -162,6 +163,28 @@ enum {
 #define COUNT_CONTINUED	0x80	/* See swap_map continuation for full count */
 #define SWAP_MAP_SHMEM	0xbf	/* Owned by shmem/tmpfs, in first swap_map */
 
+/*
+ * On solid state devices swap space is handed out in clusters of
+ * SWAPFILE_CLUSTER slots. For each cluster we keep a usage count; free
+ * clusters are chained together through the same word, so finding an
+ * empty cluster never needs a scan of swap_map.
+ */
+struct swap_cluster_info {
+	unsigned int data:24;	/* usage count, or next cluster in list */
+	unsigned int flags:8;
+};
+#define CLUSTER_FLAG_FREE	1	/* this cluster is free */
+#define CLUSTER_FLAG_NEXT_NULL	2	/* this cluster has no next cluster */
+
+/*
+ * Each cpu allocates from its own cluster, so that the device sees
+ * sequential writes.
+ */
+struct percpu_cluster {
+	struct swap_cluster_info index;	/* current cluster index */
+	unsigned int next;		/* likely next allocation offset */
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
@@ -180,6 +203,13 @@ struct swap_info_struct {
 	unsigned int cluster_nr;	/* countdown to next cluster search */
 	unsigned int lowest_alloc;	/* while preparing discard cluster */
 	unsigned int highest_alloc;	/* while preparing discard cluster */
+	struct swap_cluster_info *cluster_info;	/* cluster info, SSD only */
+	struct swap_cluster_info free_cluster_head;	/* free cluster list */
+	struct swap_cluster_info free_cluster_tail;
+	struct swap_cluster_info discard_cluster_head;	/* waiting discard */
+	struct swap_cluster_info discard_cluster_tail;
+	struct percpu_cluster __percpu *percpu_cluster;	/* per cpu cluster */
+	struct work_struct discard_work;	/* discards freed clusters */
 	struct swap_extent *curr_swap_extent;
 	struct swap_extent first_swap_extent;
 	struct block_device *bdev;	/* swap device or bdev of swap file */
@@ -195,6 +225,11 @@ struct swap_list_t {
 /* Swap 50% full? Release swapcache more aggressively.. */
 #define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
 
+/* linux/mm/workingset.c */
+void *workingset_eviction(struct address_space *mapping, struct page *page);
+bool workingset_refault(void *shadow);
+void workingset_activation(struct page *page);
+
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
 extern unsigned long totalreserve_pages;
@@ -303,6 +338,7 @@ extern void swap_unplug_io_fn(struct backing_dev_info *, struct page *);
 /* linux/mm/page_io.c */
 extern int swap_readpage(struct page *);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
+extern int __swap_writepage(struct page *page, struct writeback_control *wbc);
 extern void end_swap_bio_read(struct bio *bio, int err);
 
 /* linux/mm/swap_state.c */
@@ -7,6 +7,9 @@
 #define _LINUX_TICK_H
 
 #include <linux/clockchips.h>
+#include <linux/cpumask.h>
+
+struct task_struct;
 
 #ifdef CONFIG_GENERIC_CLOCKEVENTS
 
@@ -45,6 +48,8 @@ enum tick_nohz_mode {
  * @iowait_sleeptime:	Sum of the time slept in idle with sched tick stopped, with IO outstanding
  * @sleep_length:	Duration of the current idle sleep
  * @do_timer_lst:	CPU was the last one doing do_timer before going idle
+ * @busy_jiffies:	jiffies up to which cputime was accounted while the
+ *			tick of a busy full dynticks CPU is stopped
  */
 struct tick_sched {
 	struct hrtimer			sched_timer;
@@ -67,6 +72,7 @@ struct tick_sched {
 	unsigned long			next_jiffies;
 	ktime_t				idle_expires;
 	int				do_timer_last;
+	unsigned long			busy_jiffies;
 };
 
 extern void __init tick_init(void);
@@ -139,4 +145,36 @@ static inline u64 get_cpu_idle_time_us(int cpu, u64 *unused) { return -1; }
 static inline u64 get_cpu_iowait_time_us(int cpu, u64 *unused) { return -1; }
 # endif /* !NO_HZ */
 
+# ifdef CONFIG_NO_HZ_FULL
+extern bool tick_nohz_full_running;
+extern cpumask_var_t tick_nohz_full_mask;
+
+static inline bool tick_nohz_full_enabled(void)
+{
+	return tick_nohz_full_running;
+}
+
+static inline bool tick_nohz_full_cpu(int cpu)
+{
+	if (!tick_nohz_full_enabled())
+		return false;
+
+	return cpumask_test_cpu(cpu, tick_nohz_full_mask);
+}
+
+extern void tick_nohz_full_kick_cpu(int cpu);
+extern void tick_nohz_full_irq_exit(void);
+extern void tick_nohz_task_switch(struct task_struct *prev);
+extern void tick_nohz_user_enter(void);
+extern void tick_nohz_user_exit(void);
+# else
+static inline bool tick_nohz_full_enabled(void) { return false; }
+static inline bool tick_nohz_full_cpu(int cpu) { return false; }
+static inline void tick_nohz_full_kick_cpu(int cpu) { }
+static inline void tick_nohz_full_irq_exit(void) { }
+static inline void tick_nohz_task_switch(struct task_struct *prev) { }
+static inline void tick_nohz_user_enter(void) { }
+static inline void tick_nohz_user_exit(void) { }
+# endif /* !NO_HZ_FULL */
+
 #endif
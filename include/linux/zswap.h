@@ -0,0 +1,50 @@
+#ifndef _LINUX_ZSWAP_H
+#define _LINUX_ZSWAP_H
+
+#include <linux/types.h>
+
+struct page;
+struct zswap_tree;
+
+#ifdef CONFIG_ZSWAP
+extern int zswap_store(struct page *page);
+extern int zswap_load(struct page *page);
+extern void zswap_invalidate_page(unsigned type, pgoff_t offset);
+extern struct zswap_tree *zswap_alloc_area(unsigned type);
+extern void zswap_init_area(unsigned type, struct zswap_tree *tree);
+extern void zswap_free_area(struct zswap_tree *tree);
+extern void zswap_invalidate_area(unsigned type);
+#else
+static inline int zswap_store(struct page *page)
+{
+	return -1;
+}
+
+static inline int zswap_load(struct page *page)
+{
+	return -1;
+}
+
+static inline void zswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+}
+
+static inline struct zswap_tree *zswap_alloc_area(unsigned type)
+{
+	return NULL;
+}
+
+static inline void zswap_init_area(unsigned type, struct zswap_tree *tree)
+{
+}
+
+static inline void zswap_free_area(struct zswap_tree *tree)
+{
+}
+
+static inline void zswap_invalidate_area(unsigned type)
+{
+}
+#endif
+
+#endif /* _LINUX_ZSWAP_H */
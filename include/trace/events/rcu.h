@@ -0,0 +1,97 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rcu
+
+#if !defined(_TRACE_RCU_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_RCU_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * rcu_batch_start - called when a batch of RCU callbacks starts
+ * @rcuname:	name of the RCU flavor
+ * @qlen:	number of callbacks queued
+ * @blimit:	maximum number of callbacks to invoke, -1 if unlimited
+ *
+ * This event occurs when the RCU softirq, or the callback offload
+ * kthread of a no-CBs CPU, starts invoking a batch of callbacks whose
+ * grace period has ended. Together with rcu_batch_end it shows how
+ * long a CPU spends running callbacks.
+ */
+TRACE_EVENT(rcu_batch_start,
+
+	TP_PROTO(char *rcuname, long qlen, long blimit),
+
+	TP_ARGS(rcuname, qlen, blimit),
+
+	TP_STRUCT__entry(
+		__field(	char *,	rcuname	)
+		__field(	long,	qlen	)
+		__field(	long,	blimit	)
+	),
+
+	TP_fast_assign(
+		__entry->rcuname	= rcuname;
+		__entry->qlen		= qlen;
+		__entry->blimit		= blimit;
+	),
+
+	TP_printk("%s CBs=%ld bl=%ld",
+		  __entry->rcuname, __entry->qlen, __entry->blimit)
+);
+
+/**
+ * rcu_batch_end - called when a batch of RCU callbacks ends
+ * @rcuname:	name of the RCU flavor
+ * @callbacks_invoked:	number of callbacks invoked in this batch
+ */
+TRACE_EVENT(rcu_batch_end,
+
+	TP_PROTO(char *rcuname, int callbacks_invoked),
+
+	TP_ARGS(rcuname, callbacks_invoked),
+
+	TP_STRUCT__entry(
+		__field(	char *,	rcuname			)
+		__field(	int,	callbacks_invoked	)
+	),
+
+	TP_fast_assign(
+		__entry->rcuname		= rcuname;
+		__entry->callbacks_invoked	= callbacks_invoked;
+	),
+
+	TP_printk("%s CBs-invoked=%d",
+		  __entry->rcuname, __entry->callbacks_invoked)
+);
+
+/**
+ * rcu_nocb_wake - called when a no-CBs CPU wakes its offload kthread
+ * @rcuname:	name of the RCU flavor
+ * @cpu:	the no-CBs CPU that queued the callback
+ *
+ * Only the first callback queued on an empty offload list wakes the
+ * kthread, and none do when rcu_nocb_poll is set.
+ */
+TRACE_EVENT(rcu_nocb_wake,
+
+	TP_PROTO(char *rcuname, int cpu),
+
+	TP_ARGS(rcuname, cpu),
+
+	TP_STRUCT__entry(
+		__field(	char *,	rcuname	)
+		__field(	int,	cpu	)
+	),
+
+	TP_fast_assign(
+		__entry->rcuname	= rcuname;
+		__entry->cpu		= cpu;
+	),
+
+	TP_printk("%s cpu=%d", __entry->rcuname, __entry->cpu)
+);
+
+#endif /* _TRACE_RCU_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -1695,6 +1695,15 @@ void perf_event_task_tick(void)
 	}
 }
 
+/*
+ * Multiplexed contexts are rotated from the tick; while there are any on
+ * this cpu it has to keep ticking.
+ */
+bool perf_event_can_stop_tick(void)
+{
+	return list_empty(&__get_cpu_var(rotation_list));
+}
+
 static int event_enable_on_exec(struct perf_event *event,
 				struct perf_event_context *ctx)
 {
@@ -1300,6 +1300,21 @@ static inline int fastpath_timer_check(struct task_struct *tsk)
 	return 0;
 }
 
+/*
+ * CPU timers are only checked from the tick, so a cpu running @tsk can only
+ * stop it when neither the thread nor its thread group has one armed.
+ */
+bool posix_cpu_timers_can_stop_tick(struct task_struct *tsk)
+{
+	if (!task_cputime_zero(&tsk->cputime_expires))
+		return false;
+
+	if (tsk->signal->cputimer.running)
+		return false;
+
+	return true;
+}
+
 /*
  * This is called from the timer interrupt handler.  The irq handler has
  * already updated our counts.  We need to check if any timers fire now.
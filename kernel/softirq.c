@@ -327,6 +327,10 @@ void irq_exit(void)
 	if (!in_interrupt() && local_softirq_pending())
 		invoke_softirq();
 
+	/* Accounting and timers may need RCU, so do this before leaving it */
+	if (!in_interrupt())
+		tick_nohz_full_irq_exit();
+
 	rcu_irq_exit();
 #ifdef CONFIG_NO_HZ
 	/* Make sure that timer wheel updates are propagated */
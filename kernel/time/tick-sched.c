@@ -21,6 +21,11 @@
 #include <linux/sched.h>
 #include <linux/tick.h>
 #include <linux/module.h>
+#include <linux/irq_work.h>
+#include <linux/bootmem.h>
+#include <linux/perf_event.h>
+#include <linux/posix-timers.h>
+#include <linux/context_tracking.h>
 
 #include <asm/irq_regs.h>
 
@@ -301,6 +306,13 @@ void tick_nohz_stop_sched_tick(int inidle)
 	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
 		goto end;
 
+	/*
+	 * The full dynticks cpus rely on the timekeeping cpu to keep
+	 * jiffies going, so it can't drop its duty when going idle.
+	 */
+	if (tick_nohz_full_enabled() && cpu == tick_do_timer_cpu)
+		goto end;
+
 	if (need_resched())
 		goto end;
 
@@ -553,6 +565,324 @@ void tick_nohz_restart_sched_tick(void)
 	local_irq_enable();
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+/*
+ * Full dynticks: stop the tick of the nohz_full= cpus while they run a
+ * single task. Timekeeping stays on the boot cpu, cputime is accounted
+ * on the kernel/user boundaries and RCU sees user space as an extended
+ * quiescent state through context tracking.
+ */
+cpumask_var_t tick_nohz_full_mask;
+bool tick_nohz_full_running;
+static bool tick_nohz_full_requested __initdata;
+
+struct tick_nohz_full_kick {
+	struct call_single_data	csd;
+	struct irq_work		work;
+	unsigned long		pending;
+};
+
+static DEFINE_PER_CPU(struct tick_nohz_full_kick, tick_nohz_full_kick);
+
+static int __init tick_nohz_full_setup(char *str)
+{
+	int cpu;
+
+	alloc_bootmem_cpumask_var(&tick_nohz_full_mask);
+	if (cpulist_parse(str, tick_nohz_full_mask) < 0) {
+		printk(KERN_WARNING "NOHZ: Incorrect nohz_full cpumask\n");
+		cpumask_clear(tick_nohz_full_mask);
+		return 1;
+	}
+
+	cpu = smp_processor_id();
+	if (cpumask_test_cpu(cpu, tick_nohz_full_mask)) {
+		printk(KERN_WARNING "NOHZ: Clearing %d from nohz_full range "
+		       "for timekeeping\n", cpu);
+		cpumask_clear_cpu(cpu, tick_nohz_full_mask);
+	}
+	cpumask_and(tick_nohz_full_mask, tick_nohz_full_mask,
+		    cpu_possible_mask);
+	tick_nohz_full_requested = true;
+
+	return 1;
+}
+__setup("nohz_full=", tick_nohz_full_setup);
+
+/*
+ * The kicked cpu re-evaluates its tick from irq_exit(), so there is
+ * nothing left to do in the handlers themselves.
+ */
+static void tick_nohz_full_kick_func(void *info)
+{
+	struct tick_nohz_full_kick *kick = info;
+
+	clear_bit(0, &kick->pending);
+}
+
+static void tick_nohz_full_kick_work(struct irq_work *work)
+{
+}
+
+/**
+ * tick_nohz_full_kick_cpu - make a full dynticks cpu re-evaluate its tick
+ * @cpu: the cpu to kick
+ *
+ * Called with interrupts disabled, typically under the runqueue lock of
+ * @cpu when it gets a second task to run.
+ */
+void tick_nohz_full_kick_cpu(int cpu)
+{
+	struct tick_nohz_full_kick *kick = &per_cpu(tick_nohz_full_kick, cpu);
+
+	if (cpu == smp_processor_id()) {
+		irq_work_queue(&kick->work);
+		return;
+	}
+
+	if (!test_and_set_bit(0, &kick->pending))
+		__smp_call_function_single(cpu, &kick->csd, 0);
+}
+
+static int __init tick_nohz_full_init(void)
+{
+	int cpu;
+
+	if (!tick_nohz_full_requested || cpumask_empty(tick_nohz_full_mask))
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		struct tick_nohz_full_kick *kick;
+
+		kick = &per_cpu(tick_nohz_full_kick, cpu);
+		kick->csd.func = tick_nohz_full_kick_func;
+		kick->csd.info = kick;
+		init_irq_work(&kick->work, tick_nohz_full_kick_work);
+	}
+
+	for_each_cpu(cpu, tick_nohz_full_mask)
+		context_tracking_cpu_set(cpu);
+
+	tick_nohz_full_running = true;
+	printk(KERN_INFO "NOHZ: Full dynticks CPUs: %d\n",
+	       cpumask_weight(tick_nohz_full_mask));
+
+	return 0;
+}
+/* Before the secondary cpus come up and run anything */
+early_initcall(tick_nohz_full_init);
+
+static bool can_stop_full_tick(void)
+{
+	WARN_ON_ONCE(!irqs_disabled());
+
+	if (!sched_can_stop_tick())
+		return false;
+
+	if (!posix_cpu_timers_can_stop_tick(current))
+		return false;
+
+	if (!perf_event_can_stop_tick())
+		return false;
+
+	return true;
+}
+
+/*
+ * Account the jiffies elapsed since the tick was stopped (or since the
+ * last boundary) to @tsk, as user or system time depending on the
+ * context they were spent in.
+ */
+static void tick_nohz_account_busy_ticks(struct tick_sched *ts,
+					 struct task_struct *tsk, int user,
+					 int hardirq_offset)
+{
+	unsigned long ticks = jiffies - ts->busy_jiffies;
+	cputime_t cputime;
+
+	ts->busy_jiffies = jiffies;
+	/*
+	 * We might be one off. Do not randomly account a huge number of ticks!
+	 */
+	if (!ticks || ticks >= LONG_MAX)
+		return;
+
+	cputime = jiffies_to_cputime(ticks);
+	if (user)
+		account_user_time(tsk, cputime, cputime_to_scaled(cputime));
+	else
+		account_system_time(tsk, hardirq_offset, cputime,
+				    cputime_to_scaled(cputime));
+}
+
+/*
+ * Called from the tick handler when it fires while the tick of a busy
+ * cpu is stopped: update_process_times() accounts the current jiffy,
+ * flush the rest of the stopped period.
+ */
+static void tick_nohz_full_account_tick(struct tick_sched *ts,
+					struct pt_regs *regs)
+{
+	ts->busy_jiffies++;
+	tick_nohz_account_busy_ticks(ts, current, user_mode(regs),
+				     HARDIRQ_OFFSET);
+}
+
+/*
+ * Stop the tick, or move the stopped tick to the next timer wheel
+ * event, capped to a second so that the scheduler and the cputime
+ * statistics are never left behind for too long. Returns false if the
+ * tick has to keep running.
+ */
+static bool tick_nohz_full_stop_tick(struct tick_sched *ts, int cpu)
+{
+	unsigned long seq, last_jiffies, next_jiffies, delta_jiffies;
+	struct clock_event_device *dev = __get_cpu_var(tick_cpu_device).evtdev;
+	ktime_t last_update, expires;
+
+	if (unlikely(ts->nohz_mode == NOHZ_MODE_INACTIVE))
+		return false;
+
+	if (cpu == tick_do_timer_cpu || local_softirq_pending())
+		return false;
+
+	if (rcu_needs_cpu(cpu) || printk_needs_cpu(cpu) ||
+	    arch_needs_cpu(cpu))
+		return false;
+
+	/* Read jiffies and the time when jiffies were updated last */
+	do {
+		seq = read_seqbegin(&xtime_lock);
+		last_update = last_jiffies_update;
+		last_jiffies = jiffies;
+	} while (read_seqretry(&xtime_lock, seq));
+
+	next_jiffies = get_next_timer_interrupt(last_jiffies);
+	delta_jiffies = min_t(unsigned long, next_jiffies - last_jiffies, HZ);
+	if (delta_jiffies <= 1)
+		return false;
+
+	expires = ktime_add_ns(last_update, tick_period.tv64 * delta_jiffies);
+
+	/* Skip reprogram of event if its not changed */
+	if (ts->tick_stopped && ktime_equal(expires, dev->next_event))
+		return true;
+
+	if (!ts->tick_stopped) {
+		ts->idle_tick = hrtimer_get_expires(&ts->sched_timer);
+		ts->busy_jiffies = last_jiffies;
+		ts->tick_stopped = 1;
+	}
+
+	if (ts->nohz_mode == NOHZ_MODE_HIGHRES) {
+		hrtimer_start(&ts->sched_timer, expires,
+			      HRTIMER_MODE_ABS_PINNED);
+		/* Check, if the timer was already in the past */
+		if (hrtimer_active(&ts->sched_timer))
+			return true;
+	} else if (!tick_program_event(expires, 0))
+		return true;
+
+	/* We are past the event already, let the tick run */
+	return false;
+}
+
+static void tick_nohz_full_restart(struct tick_sched *ts,
+				   struct task_struct *tsk, int user)
+{
+	tick_nohz_account_busy_ticks(ts, tsk, user, 0);
+	ts->tick_stopped = 0;
+	tick_nohz_restart(ts, ktime_get());
+}
+
+static void tick_nohz_full_update_tick(struct tick_sched *ts, int cpu,
+				       int user)
+{
+	if (can_stop_full_tick() && tick_nohz_full_stop_tick(ts, cpu))
+		return;
+
+	if (ts->tick_stopped)
+		tick_nohz_full_restart(ts, current, user);
+}
+
+/**
+ * tick_nohz_full_irq_exit - re-evaluate the tick of a busy full dynticks cpu
+ *
+ * Called from irq_exit() once the last interrupt level is left. The idle
+ * loop takes care of the tick on its own.
+ */
+void tick_nohz_full_irq_exit(void)
+{
+	int cpu = smp_processor_id();
+	struct tick_sched *ts = &per_cpu(tick_cpu_sched, cpu);
+
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	if (ts->inidle || current == idle_task(cpu))
+		return;
+
+	tick_nohz_full_update_tick(ts, cpu, context_tracking_in_user());
+}
+
+/**
+ * tick_nohz_task_switch - restart the stopped tick on context switch
+ * @prev: the task that was switched out
+ *
+ * The next task is accounted from scratch and may well not be alone on
+ * the runqueue: let the tick run and irq_exit() stop it again if it can.
+ */
+void tick_nohz_task_switch(struct task_struct *prev)
+{
+	struct tick_sched *ts;
+	unsigned long flags;
+	int cpu;
+
+	local_irq_save(flags);
+	cpu = smp_processor_id();
+	ts = &per_cpu(tick_cpu_sched, cpu);
+	if (tick_nohz_full_cpu(cpu) && ts->tick_stopped && !ts->inidle)
+		tick_nohz_full_restart(ts, prev, 0);
+	local_irq_restore(flags);
+}
+
+/**
+ * tick_nohz_user_enter - flush the system time before resuming user space
+ *
+ * Called from user_enter() with interrupts disabled. Also a good time to
+ * stop the tick, or to restart it if something was queued meanwhile.
+ */
+void tick_nohz_user_enter(void)
+{
+	int cpu = smp_processor_id();
+	struct tick_sched *ts = &per_cpu(tick_cpu_sched, cpu);
+
+	if (!tick_nohz_full_cpu(cpu))
+		return;
+
+	if (ts->tick_stopped)
+		tick_nohz_account_busy_ticks(ts, current, 0, 0);
+	tick_nohz_full_update_tick(ts, cpu, 0);
+}
+
+/**
+ * tick_nohz_user_exit - flush the user time on kernel entry
+ *
+ * Called from user_exit() with interrupts disabled.
+ */
+void tick_nohz_user_exit(void)
+{
+	int cpu = smp_processor_id();
+	struct tick_sched *ts = &per_cpu(tick_cpu_sched, cpu);
+
+	if (tick_nohz_full_cpu(cpu) && ts->tick_stopped)
+		tick_nohz_account_busy_ticks(ts, current, 1, 0);
+}
+#else
+static inline void tick_nohz_full_account_tick(struct tick_sched *ts,
+					       struct pt_regs *regs) { }
+#endif /* CONFIG_NO_HZ_FULL */
+
 static int tick_nohz_reprogram(struct tick_sched *ts, ktime_t now)
 {
 	hrtimer_forward(&ts->sched_timer, now, tick_period);
@@ -578,7 +908,8 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 
 	/* Check, if the jiffies need an update */
@@ -592,10 +923,14 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 * waiting on the login prompt. We also increment the "start
 	 * of idle" jiffy stamp so the idle accounting adjustment we
 	 * do when we go busy again does not account too much ticks.
+	 * A busy full dynticks cpu flushes its cputime instead.
 	 */
 	if (ts->tick_stopped) {
 		touch_softlockup_watchdog();
-		ts->idle_jiffies++;
+		if (ts->inidle)
+			ts->idle_jiffies++;
+		else
+			tick_nohz_full_account_tick(ts, regs);
 	}
 
 	update_process_times(user_mode(regs));
@@ -697,6 +1032,8 @@ static inline void tick_check_nohz(int cpu)
 
 static inline void tick_nohz_switch_to_nohz(void) { }
 static inline void tick_check_nohz(int cpu) { }
+static inline void tick_nohz_full_account_tick(struct tick_sched *ts,
+					       struct pt_regs *regs) { }
 
 #endif /* NO_HZ */
 
@@ -733,7 +1070,8 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 #endif
 
@@ -753,10 +1091,14 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 		 * waiting on the login prompt. We also increment the "start of
 		 * idle" jiffy stamp so the idle accounting adjustment we do
 		 * when we go busy again does not account too much ticks.
+		 * A busy full dynticks cpu flushes its cputime instead.
 		 */
 		if (ts->tick_stopped) {
 			touch_softlockup_watchdog();
-			ts->idle_jiffies++;
+			if (ts->inidle)
+				ts->idle_jiffies++;
+			else
+				tick_nohz_full_account_tick(ts, regs);
 		}
 		update_process_times(user_mode(regs));
 		profile_tick(CPU_PROFILING);
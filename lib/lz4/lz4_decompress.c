@@ -0,0 +1,106 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Every length and offset read from the stream is checked against the
+ *  input and output buffers, so corrupt data cannot overrun either.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+int lz4_decompress_safe(const unsigned char *in, size_t in_len,
+			unsigned char *out, size_t *out_len)
+{
+	const unsigned char * const ip_end = in + in_len;
+	unsigned char * const op_end = out + *out_len;
+	const unsigned char *ip = in, *m_pos;
+	unsigned char *op = out;
+	size_t len, off;
+	unsigned int token, t;
+
+	for (;;) {
+		if (unlikely(ip >= ip_end))
+			goto input_overrun;
+		token = *ip++;
+
+		/* literal run */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK) {
+			do {
+				if (unlikely(ip >= ip_end))
+					goto input_overrun;
+				t = *ip++;
+				len += t;
+			} while (t == 255);
+		}
+		if (unlikely(len > (size_t)(ip_end - ip)))
+			goto input_overrun;
+		if (unlikely(len > (size_t)(op_end - op)))
+			goto output_overrun;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* the last sequence carries literals only */
+		if (ip == ip_end)
+			break;
+
+		/* match */
+		if (unlikely(ip_end - ip < 2))
+			goto input_overrun;
+		off = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(off == 0 || off > (size_t)(op - out)))
+			goto lookbehind_overrun;
+		m_pos = op - off;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK) {
+			do {
+				if (unlikely(ip >= ip_end))
+					goto input_overrun;
+				t = *ip++;
+				len += t;
+			} while (t == 255);
+		}
+		len += MINMATCH;
+		if (unlikely(len > (size_t)(op_end - op)))
+			goto output_overrun;
+
+		if (off >= len) {
+			memcpy(op, m_pos, len);
+			op += len;
+		} else {
+			/* overlapping copy replicates the last 'off' bytes */
+			while (len--)
+				*op++ = *m_pos++;
+		}
+	}
+
+	*out_len = op - out;
+	return LZ4_E_OK;
+
+input_overrun:
+	*out_len = op - out;
+	return LZ4_E_INPUT_OVERRUN;
+
+output_overrun:
+	*out_len = op - out;
+	return LZ4_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*out_len = op - out;
+	return LZ4_E_LOOKBEHIND_OVERRUN;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
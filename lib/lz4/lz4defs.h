@@ -0,0 +1,30 @@
+/*
+ *  lz4defs.h -- common definitions for the LZ4 compressor and decompressor
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+/*
+ * Every sequence starts with a token byte: the high nibble is the literal
+ * run length, the low nibble is the match length minus MINMATCH. A nibble
+ * value of 15 is followed by extension bytes (255 means "more follows").
+ * Matches are encoded as a 16-bit little endian backward offset.
+ */
+#define MINMATCH	4
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define MAX_DISTANCE	0xffff
+
+/* The last match must start at least MFLIMIT bytes before the end */
+#define MFLIMIT		12
+/* The last LASTLITERALS bytes are always encoded as literals */
+#define LASTLITERALS	5
+
+/* Acceleration of the match search over incompressible data */
+#define SKIP_STRENGTH	6
@@ -261,7 +261,7 @@ static unsigned long isolate_migratepages(struct zone *zone,
 	}
 
 	/* Time to isolate some pages for migration */
-	spin_lock_irq(&zone->lru_lock);
+	lru_lock_irq(zone);
 	for (; low_pfn < end_pfn; low_pfn++) {
 		struct page *page;
 		if (!pfn_valid_within(low_pfn))
@@ -288,7 +288,7 @@ static unsigned long isolate_migratepages(struct zone *zone,
 
 	acct_isolated(zone, cc);
 
-	spin_unlock_irq(&zone->lru_lock);
+	lru_unlock_irq(zone);
 	cc->migrate_pfn = low_pfn;
 
 	return cc->nr_migratepages;
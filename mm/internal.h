@@ -12,6 +12,7 @@
 #define __MM_INTERNAL_H
 
 #include <linux/mm.h>
+#include <linux/sched.h>
 
 void free_pgtables(struct mmu_gather *tlb, struct vm_area_struct *start_vma,
 		unsigned long floor, unsigned long ceiling);
@@ -45,6 +46,77 @@ extern unsigned long highest_memmap_pfn;
 extern int isolate_lru_page(struct page *page);
 extern void putback_lru_page(struct page *page);
 
+/*
+ * zone->lru_lock accounting, in mm/swap.c.
+ *
+ * Contended acquisitions are reported in /proc/vmstat as
+ * lru_lock_contended.  With CONFIG_LRU_LOCK_STATS the time the lock is
+ * held is reported as lru_lock_hold_ns as well.  The lru_lock is always
+ * held with interrupts disabled and never nests with another zone's
+ * lru_lock, so a single per-cpu timestamp is enough.
+ */
+#ifdef CONFIG_LRU_LOCK_STATS
+DECLARE_PER_CPU(u64, lru_lock_stamp);
+
+static inline void lru_lock_stamp_start(void)
+{
+	__this_cpu_write(lru_lock_stamp, local_clock());
+}
+
+static inline void lru_lock_stamp_end(void)
+{
+	__count_vm_events(LRU_LOCK_HOLD_NS,
+			  local_clock() - __this_cpu_read(lru_lock_stamp));
+}
+#else
+static inline void lru_lock_stamp_start(void) { }
+static inline void lru_lock_stamp_end(void) { }
+#endif
+
+/* Returns true if the lock had to be waited for. */
+static inline bool __lru_lock(struct zone *zone)
+{
+	bool contended = false;
+
+	if (unlikely(!spin_trylock(&zone->lru_lock))) {
+		__count_vm_event(LRU_LOCK_CONTENDED);
+		spin_lock(&zone->lru_lock);
+		contended = true;
+	}
+	lru_lock_stamp_start();
+	return contended;
+}
+
+static inline void __lru_unlock(struct zone *zone)
+{
+	lru_lock_stamp_end();
+	spin_unlock(&zone->lru_lock);
+}
+
+static inline bool lru_lock_irq(struct zone *zone)
+{
+	local_irq_disable();
+	return __lru_lock(zone);
+}
+
+static inline void lru_unlock_irq(struct zone *zone)
+{
+	__lru_unlock(zone);
+	local_irq_enable();
+}
+
+#define lru_lock_irqsave(zone, flags)		\
+	do {					\
+		local_irq_save(flags);		\
+		__lru_lock(zone);		\
+	} while (0)
+
+#define lru_unlock_irqrestore(zone, flags)	\
+	do {					\
+		__lru_unlock(zone);		\
+		local_irq_restore(flags);	\
+	} while (0)
+
 /*
  * in mm/page_alloc.c
  */
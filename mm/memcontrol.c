@@ -888,14 +888,14 @@ static void mem_cgroup_lru_del_before_commit_swapcache(struct page *page)
 	struct zone *zone = page_zone(page);
 	struct page_cgroup *pc = lookup_page_cgroup(page);
 
-	spin_lock_irqsave(&zone->lru_lock, flags);
+	lru_lock_irqsave(zone, flags);
 	/*
 	 * Forget old LRU when this page_cgroup is *not* used. This Used bit
 	 * is guarded by lock_page() because the page is SwapCache.
 	 */
 	if (!PageCgroupUsed(pc))
 		mem_cgroup_del_lru_list(page, page_lru(page));
-	spin_unlock_irqrestore(&zone->lru_lock, flags);
+	lru_unlock_irqrestore(zone, flags);
 }
 
 static void mem_cgroup_lru_add_after_commit_swapcache(struct page *page)
@@ -904,11 +904,11 @@ static void mem_cgroup_lru_add_after_commit_swapcache(struct page *page)
 	struct zone *zone = page_zone(page);
 	struct page_cgroup *pc = lookup_page_cgroup(page);
 
-	spin_lock_irqsave(&zone->lru_lock, flags);
+	lru_lock_irqsave(zone, flags);
 	/* link when the page is linked to LRU but page_cgroup isn't */
 	if (PageLRU(page) && !PageCgroupAcctLRU(pc))
 		mem_cgroup_add_lru_list(page, page_lru(page));
-	spin_unlock_irqrestore(&zone->lru_lock, flags);
+	lru_unlock_irqrestore(zone, flags);
 }
 
 
@@ -3173,19 +3173,19 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 	busy = NULL;
 	while (loop--) {
 		ret = 0;
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		lru_lock_irqsave(zone, flags);
 		if (list_empty(list)) {
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			lru_unlock_irqrestore(zone, flags);
 			break;
 		}
 		pc = list_entry(list->prev, struct page_cgroup, lru);
 		if (busy == pc) {
 			list_move(&pc->lru, list);
 			busy = NULL;
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			lru_unlock_irqrestore(zone, flags);
 			continue;
 		}
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		lru_unlock_irqrestore(zone, flags);
 
 		ret = mem_cgroup_move_parent(pc, mem, GFP_KERNEL);
 		if (ret == -ENOMEM)
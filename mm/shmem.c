@@ -60,6 +60,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/falloc.h>
 
 #include <asm/uaccess.h>
 #include <asm/div64.h>
@@ -819,6 +820,68 @@ static int shmem_notify_change(struct dentry *dentry, struct iattr *attr)
 	return error;
 }
 
+/*
+ * Zero part of a page that is only partially covered by a hole punch,
+ * bringing it back from swap if need be.  Nothing to do for a hole.
+ */
+static void shmem_zero_partial_page(struct inode *inode, loff_t from,
+				    unsigned int len)
+{
+	struct page *page = NULL;
+
+	(void) shmem_getpage(inode, from >> PAGE_CACHE_SHIFT,
+				&page, SGP_READ, NULL);
+	if (page) {
+		zero_user(page, from & (PAGE_CACHE_SIZE - 1), len);
+		set_page_dirty(page);
+		unlock_page(page);
+		page_cache_release(page);
+	}
+}
+
+static long shmem_fallocate(struct inode *inode, int mode, loff_t offset,
+			    loff_t len)
+{
+	struct address_space *mapping = inode->i_mapping;
+	loff_t start, end;
+
+	/* tmpfs has nothing to preallocate, only holes can be punched */
+	if (!(mode & FALLOC_FL_PUNCH_HOLE))
+		return -EOPNOTSUPP;
+
+	mutex_lock(&inode->i_mutex);
+	down_write(&inode->i_alloc_sem);
+	if (offset >= inode->i_size)
+		goto out;
+	if (len > inode->i_size - offset)
+		len = inode->i_size - offset;
+
+	start = (offset + PAGE_CACHE_SIZE - 1) & PAGE_CACHE_MASK;
+	end = (offset + len) & PAGE_CACHE_MASK;
+	if (start > end) {
+		/* the whole hole is within one page */
+		shmem_zero_partial_page(inode, offset, len);
+		goto done;
+	}
+	if (offset < start)
+		shmem_zero_partial_page(inode, offset, start - offset);
+	if (offset + len > end)
+		shmem_zero_partial_page(inode, end, offset + len - end);
+
+	if (start < end) {
+		unmap_mapping_range(mapping, start, end - start, 1);
+		truncate_inode_pages_range(mapping, start, end - 1);
+		unmap_mapping_range(mapping, start, end - start, 1);
+		shmem_truncate_range(inode, start, end - 1);
+	}
+done:
+	inode->i_ctime = inode->i_mtime = CURRENT_TIME;
+out:
+	up_write(&inode->i_alloc_sem);
+	mutex_unlock(&inode->i_mutex);
+	return 0;
+}
+
 static void shmem_evict_inode(struct inode *inode)
 {
 	struct shmem_inode_info *info = SHMEM_I(inode);
@@ -2473,6 +2536,7 @@ static const struct file_operations shmem_file_operations = {
 static const struct inode_operations shmem_inode_operations = {
 	.setattr	= shmem_notify_change,
 	.truncate_range	= shmem_truncate_range,
+	.fallocate	= shmem_fallocate,
 #ifdef CONFIG_TMPFS_POSIX_ACL
 	.setxattr	= generic_setxattr,
 	.getxattr	= generic_getxattr,
@@ -40,6 +40,19 @@ int page_cluster;
 static DEFINE_PER_CPU(struct pagevec[NR_LRU_LISTS], lru_add_pvecs);
 static DEFINE_PER_CPU(struct pagevec, lru_rotate_pvecs);
 
+/*
+ * The lru_add pagevecs are drained once they hold lru_add_batch pages.
+ * The batch starts out at PAGEVEC_SIZE; when draining finds zone->lru_lock
+ * contended it is halved, down to LRU_ADD_BATCH_MIN, to shorten the hold
+ * time, and every uncontended drain grows it back by one page.
+ */
+#define LRU_ADD_BATCH_MIN	14
+static DEFINE_PER_CPU(unsigned int, lru_add_batch) = PAGEVEC_SIZE;
+
+#ifdef CONFIG_LRU_LOCK_STATS
+DEFINE_PER_CPU(u64, lru_lock_stamp);
+#endif
+
 /*
  * This path almost never happens for VM activity - pages are normally
  * freed via pagevecs.  But it gets used by networking.
@@ -50,11 +63,11 @@ static void __page_cache_release(struct page *page)
 		unsigned long flags;
 		struct zone *zone = page_zone(page);
 
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		lru_lock_irqsave(zone, flags);
 		VM_BUG_ON(!PageLRU(page));
 		__ClearPageLRU(page);
 		del_page_from_lru(zone, page);
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		lru_unlock_irqrestore(zone, flags);
 	}
 	free_hot_cold_page(page, 0);
 }
@@ -114,9 +127,9 @@ static void pagevec_move_tail(struct pagevec *pvec)
 
 		if (pagezone != zone) {
 			if (zone)
-				spin_unlock(&zone->lru_lock);
+				__lru_unlock(zone);
 			zone = pagezone;
-			spin_lock(&zone->lru_lock);
+			__lru_lock(zone);
 		}
 		if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
 			int lru = page_lru_base_type(page);
@@ -125,7 +138,7 @@ static void pagevec_move_tail(struct pagevec *pvec)
 		}
 	}
 	if (zone)
-		spin_unlock(&zone->lru_lock);
+		__lru_unlock(zone);
 	__count_vm_events(PGROTATED, pgmoved);
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
@@ -179,7 +192,7 @@ void activate_page(struct page *page)
 {
 	struct zone *zone = page_zone(page);
 
-	spin_lock_irq(&zone->lru_lock);
+	lru_lock_irq(zone);
 	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
 		int file = page_is_file_cache(page);
 		int lru = page_lru_base_type(page);
@@ -192,7 +205,7 @@ void activate_page(struct page *page)
 
 		update_page_reclaim_stat(zone, page, file, 1);
 	}
-	spin_unlock_irq(&zone->lru_lock);
+	lru_unlock_irq(zone);
 }
 
 /*
@@ -208,6 +221,8 @@ void mark_page_accessed(struct page *page)
 			PageReferenced(page) && PageLRU(page)) {
 		activate_page(page);
 		ClearPageReferenced(page);
+		if (page_is_file_cache(page))
+			workingset_activation(page);
 	} else if (!PageReferenced(page)) {
 		SetPageReferenced(page);
 	}
@@ -215,13 +230,22 @@ void mark_page_accessed(struct page *page)
 
 EXPORT_SYMBOL(mark_page_accessed);
 
+static int __pagevec_lru_add_batch(struct pagevec *pvec, enum lru_list lru);
+
 void __lru_cache_add(struct page *page, enum lru_list lru)
 {
 	struct pagevec *pvec = &get_cpu_var(lru_add_pvecs)[lru];
+	unsigned int batch = __this_cpu_read(lru_add_batch);
 
 	page_cache_get(page);
-	if (!pagevec_add(pvec, page))
-		____pagevec_lru_add(pvec, lru);
+	pagevec_add(pvec, page);
+	if (pagevec_count(pvec) >= batch) {
+		if (__pagevec_lru_add_batch(pvec, lru))
+			batch = max_t(unsigned int, batch / 2, LRU_ADD_BATCH_MIN);
+		else if (batch < PAGEVEC_SIZE)
+			batch++;
+		__this_cpu_write(lru_add_batch, batch);
+	}
 	put_cpu_var(lru_add_pvecs);
 }
 EXPORT_SYMBOL(__lru_cache_add);
@@ -259,11 +283,11 @@ void add_page_to_unevictable_list(struct page *page)
 {
 	struct zone *zone = page_zone(page);
 
-	spin_lock_irq(&zone->lru_lock);
+	lru_lock_irq(zone);
 	SetPageUnevictable(page);
 	SetPageLRU(page);
 	add_page_to_lru_list(zone, page, LRU_UNEVICTABLE);
-	spin_unlock_irq(&zone->lru_lock);
+	lru_unlock_irq(zone);
 }
 
 /*
@@ -339,7 +363,7 @@ void release_pages(struct page **pages, int nr, int cold)
 
 		if (unlikely(PageCompound(page))) {
 			if (zone) {
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
+				lru_unlock_irqrestore(zone, flags);
 				zone = NULL;
 			}
 			put_compound_page(page);
@@ -354,10 +378,9 @@ void release_pages(struct page **pages, int nr, int cold)
 
 			if (pagezone != zone) {
 				if (zone)
-					spin_unlock_irqrestore(&zone->lru_lock,
-									flags);
+					lru_unlock_irqrestore(zone, flags);
 				zone = pagezone;
-				spin_lock_irqsave(&zone->lru_lock, flags);
+				lru_lock_irqsave(zone, flags);
 			}
 			VM_BUG_ON(!PageLRU(page));
 			__ClearPageLRU(page);
@@ -366,7 +389,7 @@ void release_pages(struct page **pages, int nr, int cold)
 
 		if (!pagevec_add(&pages_to_free, page)) {
 			if (zone) {
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
+				lru_unlock_irqrestore(zone, flags);
 				zone = NULL;
 			}
 			__pagevec_free(&pages_to_free);
@@ -374,7 +397,7 @@ void release_pages(struct page **pages, int nr, int cold)
   		}
 	}
 	if (zone)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		lru_unlock_irqrestore(zone, flags);
 
 	pagevec_free(&pages_to_free);
 }
@@ -401,11 +424,13 @@ EXPORT_SYMBOL(__pagevec_release);
 
 /*
  * Add the passed pages to the LRU, then drop the caller's refcount
- * on them.  Reinitialises the caller's pagevec.
+ * on them.  Reinitialises the caller's pagevec.  Returns the number of
+ * zone->lru_lock acquisitions that were contended.
  */
-void ____pagevec_lru_add(struct pagevec *pvec, enum lru_list lru)
+static int __pagevec_lru_add_batch(struct pagevec *pvec, enum lru_list lru)
 {
 	int i;
+	int contended = 0;
 	struct zone *zone = NULL;
 
 	VM_BUG_ON(is_unevictable_lru(lru));
@@ -418,9 +443,9 @@ void ____pagevec_lru_add(struct pagevec *pvec, enum lru_list lru)
 
 		if (pagezone != zone) {
 			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
+				lru_unlock_irq(zone);
 			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
+			contended += lru_lock_irq(zone);
 		}
 		VM_BUG_ON(PageActive(page));
 		VM_BUG_ON(PageUnevictable(page));
@@ -434,9 +459,15 @@ void ____pagevec_lru_add(struct pagevec *pvec, enum lru_list lru)
 		add_page_to_lru_list(zone, page, lru);
 	}
 	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
+		lru_unlock_irq(zone);
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
+	return contended;
+}
+
+void ____pagevec_lru_add(struct pagevec *pvec, enum lru_list lru)
+{
+	__pagevec_lru_add_batch(pvec, lru);
 }
 
 EXPORT_SYMBOL(____pagevec_lru_add);
@@ -31,6 +31,7 @@
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
 #include <linux/poll.h>
+#include <linux/zswap.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -40,6 +41,8 @@
 static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
 				 unsigned char);
 static void free_swap_count_continuations(struct swap_info_struct *);
+static unsigned char swap_entry_free(struct swap_info_struct *,
+				     swp_entry_t, unsigned char);
 static sector_t map_swap_entry(swp_entry_t, struct block_device**);
 
 static DEFINE_SPINLOCK(swap_lock);
@@ -212,6 +215,286 @@ static int wait_for_discard(void *word)
 #define SWAPFILE_CLUSTER	256
 #define LATENCY_LIMIT		256
 
+static inline void cluster_set_flag(struct swap_cluster_info *info,
+				    unsigned int flag)
+{
+	info->flags = flag;
+}
+
+static inline unsigned int cluster_count(struct swap_cluster_info *info)
+{
+	return info->data;
+}
+
+static inline void cluster_set_count(struct swap_cluster_info *info,
+				     unsigned int c)
+{
+	info->data = c;
+}
+
+static inline void cluster_set_count_flag(struct swap_cluster_info *info,
+					  unsigned int c, unsigned int f)
+{
+	info->flags = f;
+	info->data = c;
+}
+
+static inline unsigned int cluster_next(struct swap_cluster_info *info)
+{
+	return info->data;
+}
+
+static inline void cluster_set_next(struct swap_cluster_info *info,
+				    unsigned int n)
+{
+	info->data = n;
+}
+
+static inline void cluster_set_next_flag(struct swap_cluster_info *info,
+					 unsigned int n, unsigned int f)
+{
+	info->flags = f;
+	info->data = n;
+}
+
+static inline bool cluster_is_free(struct swap_cluster_info *info)
+{
+	return info->flags & CLUSTER_FLAG_FREE;
+}
+
+static inline bool cluster_is_null(struct swap_cluster_info *info)
+{
+	return info->flags & CLUSTER_FLAG_NEXT_NULL;
+}
+
+static inline void cluster_set_null(struct swap_cluster_info *info)
+{
+	info->flags = CLUSTER_FLAG_NEXT_NULL;
+	info->data = 0;
+}
+
+/*
+ * Cluster lists are singly linked through cluster_info[].data, with the
+ * head and tail indices kept in the swap_info_struct.  All of this is
+ * protected by swap_lock.
+ */
+static void cluster_list_add_tail(struct swap_cluster_info *head,
+				  struct swap_cluster_info *tail,
+				  struct swap_cluster_info *ci,
+				  unsigned int idx)
+{
+	if (cluster_is_null(head)) {
+		cluster_set_next_flag(head, idx, 0);
+		cluster_set_next_flag(tail, idx, 0);
+	} else {
+		cluster_set_next(&ci[cluster_next(tail)], idx);
+		cluster_set_next_flag(tail, idx, 0);
+	}
+}
+
+static unsigned int cluster_list_del_first(struct swap_cluster_info *head,
+					   struct swap_cluster_info *tail,
+					   struct swap_cluster_info *ci)
+{
+	unsigned int idx = cluster_next(head);
+
+	if (cluster_next(tail) == idx) {
+		cluster_set_null(head);
+		cluster_set_null(tail);
+	} else
+		cluster_set_next_flag(head, cluster_next(&ci[idx]), 0);
+	return idx;
+}
+
+static void free_cluster(struct swap_info_struct *si, unsigned int idx)
+{
+	cluster_set_flag(&si->cluster_info[idx], CLUSTER_FLAG_FREE);
+	cluster_list_add_tail(&si->free_cluster_head, &si->free_cluster_tail,
+			      si->cluster_info, idx);
+}
+
+/*
+ * A cluster freed on a discardable device is queued for discard rather
+ * than put straight back on the free list.  Its slots are marked bad
+ * meanwhile, so that nobody allocates them before the discard is done.
+ */
+static void swap_cluster_schedule_discard(struct swap_info_struct *si,
+					  unsigned int idx)
+{
+	memset(si->swap_map + idx * SWAPFILE_CLUSTER,
+	       SWAP_MAP_BAD, SWAPFILE_CLUSTER);
+	cluster_list_add_tail(&si->discard_cluster_head,
+			      &si->discard_cluster_tail, si->cluster_info, idx);
+	schedule_work(&si->discard_work);
+}
+
+/*
+ * Discard the clusters queued by swap_cluster_schedule_discard() and
+ * make them available again.  Called with swap_lock held, but drops it
+ * around each discard.
+ */
+static void swap_do_scheduled_discard(struct swap_info_struct *si)
+{
+	unsigned int idx;
+
+	while (!cluster_is_null(&si->discard_cluster_head)) {
+		idx = cluster_list_del_first(&si->discard_cluster_head,
+					     &si->discard_cluster_tail,
+					     si->cluster_info);
+		spin_unlock(&swap_lock);
+
+		discard_swap_cluster(si, idx * SWAPFILE_CLUSTER,
+				     SWAPFILE_CLUSTER);
+
+		spin_lock(&swap_lock);
+		memset(si->swap_map + idx * SWAPFILE_CLUSTER,
+		       0, SWAPFILE_CLUSTER);
+		free_cluster(si, idx);
+	}
+}
+
+static void swap_discard_work(struct work_struct *work)
+{
+	struct swap_info_struct *si;
+
+	si = container_of(work, struct swap_info_struct, discard_work);
+
+	spin_lock(&swap_lock);
+	swap_do_scheduled_discard(si);
+	spin_unlock(&swap_lock);
+}
+
+/*
+ * The cluster containing page_nr is about to get one more slot in use:
+ * take it off the free list if it was free.  Free clusters are only
+ * ever allocated from at the head of the list (see
+ * scan_swap_map_ssd_cluster_conflict()).
+ */
+static void inc_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long page_nr)
+{
+	struct swap_cluster_info *ci = si->cluster_info;
+	unsigned long idx = page_nr / SWAPFILE_CLUSTER;
+
+	if (!ci)
+		return;
+	if (cluster_is_free(&ci[idx])) {
+		VM_BUG_ON(cluster_next(&si->free_cluster_head) != idx);
+		cluster_list_del_first(&si->free_cluster_head,
+				       &si->free_cluster_tail, ci);
+		cluster_set_count_flag(&ci[idx], 0, 0);
+	}
+
+	VM_BUG_ON(cluster_count(&ci[idx]) >= SWAPFILE_CLUSTER);
+	cluster_set_count(&ci[idx], cluster_count(&ci[idx]) + 1);
+}
+
+/*
+ * The cluster containing page_nr has one slot less in use: put it back
+ * on the free list (or queue it for discard) once it is empty.
+ */
+static void dec_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long page_nr)
+{
+	struct swap_cluster_info *ci = si->cluster_info;
+	unsigned long idx = page_nr / SWAPFILE_CLUSTER;
+
+	if (!ci)
+		return;
+
+	VM_BUG_ON(cluster_count(&ci[idx]) == 0);
+	cluster_set_count(&ci[idx], cluster_count(&ci[idx]) - 1);
+
+	if (cluster_count(&ci[idx]) == 0) {
+		if ((si->flags & (SWP_WRITEOK | SWP_DISCARDABLE)) ==
+				 (SWP_WRITEOK | SWP_DISCARDABLE)) {
+			swap_cluster_schedule_discard(si, idx);
+			return;
+		}
+		free_cluster(si, idx);
+	}
+}
+
+/*
+ * It's possible that scan_swap_map() uses a free cluster in the middle
+ * of the free cluster list.  Avoid that, or the free list would have to
+ * be searched: drop our cpu's cluster and let the caller pick the head.
+ */
+static bool scan_swap_map_ssd_cluster_conflict(struct swap_info_struct *si,
+					       unsigned long offset)
+{
+	struct percpu_cluster *percpu_cluster;
+	bool conflict;
+
+	offset /= SWAPFILE_CLUSTER;
+	conflict = !cluster_is_null(&si->free_cluster_head) &&
+		offset != cluster_next(&si->free_cluster_head) &&
+		cluster_is_free(&si->cluster_info[offset]);
+
+	if (!conflict)
+		return false;
+
+	percpu_cluster = this_cpu_ptr(si->percpu_cluster);
+	cluster_set_null(&percpu_cluster->index);
+	return true;
+}
+
+/*
+ * Try to get a swap entry from this cpu's cluster, taking a new cluster
+ * off the free list once the current one is used up.  Leaves *offset
+ * alone if there is no free cluster left.
+ */
+static void scan_swap_map_try_ssd_cluster(struct swap_info_struct *si,
+					  unsigned long *offset,
+					  unsigned long *scan_base)
+{
+	struct percpu_cluster *cluster;
+	unsigned long tmp, max;
+	bool found_free;
+
+new_cluster:
+	cluster = this_cpu_ptr(si->percpu_cluster);
+	if (cluster_is_null(&cluster->index)) {
+		if (!cluster_is_null(&si->free_cluster_head)) {
+			cluster->index = si->free_cluster_head;
+			cluster->next = cluster_next(&cluster->index) *
+					SWAPFILE_CLUSTER;
+		} else if (!cluster_is_null(&si->discard_cluster_head)) {
+			/*
+			 * No free cluster, but some are being discarded:
+			 * finish the discard now and use those.
+			 */
+			swap_do_scheduled_discard(si);
+			*scan_base = *offset = si->cluster_next;
+			goto new_cluster;
+		} else
+			return;
+	}
+
+	/*
+	 * Other cpus can allocate from our cluster when they can't find a
+	 * free one, so check that there is still a free entry in it.
+	 */
+	found_free = false;
+	tmp = cluster->next;
+	max = min_t(unsigned long, si->max,
+		    (cluster_next(&cluster->index) + 1) * SWAPFILE_CLUSTER);
+	while (tmp < max) {
+		if (!si->swap_map[tmp]) {
+			found_free = true;
+			break;
+		}
+		tmp++;
+	}
+	if (!found_free) {
+		cluster_set_null(&cluster->index);
+		goto new_cluster;
+	}
+	cluster->next = tmp + 1;
+	*offset = tmp;
+	*scan_base = tmp;
+}
+
 static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 					  unsigned char usage)
 {
@@ -235,6 +518,12 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	/* SSD algorithm */
+	if (si->cluster_info) {
+		scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+		goto checks;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
@@ -320,6 +609,11 @@ checks:
 	if (offset > si->highest_bit)
 		scan_base = offset = si->lowest_bit;
 
+	if (si->cluster_info) {
+		while (scan_swap_map_ssd_cluster_conflict(si, offset))
+			scan_swap_map_try_ssd_cluster(si, &offset, &scan_base);
+	}
+
 	/* reuse swap entry of cache-only swap if not busy. */
 	if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
 		int swap_was_freed;
@@ -345,6 +639,7 @@ checks:
 		si->highest_bit = 0;
 	}
 	si->swap_map[offset] = usage;
+	inc_cluster_info_page(si, offset);
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
@@ -441,17 +736,24 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to n swap entries for the swap cache, all under a single
+ * acquisition of swap_lock.  Returns the number of entries allocated.
+ */
+static int get_swap_pages(int n, swp_entry_t swp_entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
+	int n_ret = 0;
 
 	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
-	nr_swap_pages--;
+	if (n > nr_swap_pages)
+		n = nr_swap_pages;
+	nr_swap_pages -= n;
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info[type];
@@ -469,20 +771,203 @@ swp_entry_t get_swap_page(void)
 
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
+		while (n_ret < n) {
+			offset = scan_swap_map(si, SWAP_HAS_CACHE);
+			if (!offset)
+				break;
+			swp_entries[n_ret++] = swp_entry(type, offset);
 		}
+		if (n_ret == n)
+			break;
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
+	nr_swap_pages += n - n_ret;
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return n_ret;
+}
+
+/*
+ * Swap slots are allocated, and the swap cache's reference to them is
+ * dropped, in batches through a small per-cpu cache, so that swap_lock
+ * is taken once per batch rather than once per page.
+ */
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr, cur */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+	int		n_ret;
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static bool swap_slot_cache_enabled __read_mostly;
+
+/*
+ * Don't let the per-cpu caches hold on to the last free slots: once
+ * swap is this close to full, allocate and free slots one at a time.
+ */
+static inline bool swap_slot_cache_active(void)
+{
+	return swap_slot_cache_enabled &&
+		nr_swap_pages > num_online_cpus() * SWAP_SLOTS_CACHE_SIZE * 2;
+}
+
+/*
+ * Drop the swap cache reference on a batch of entries.  Each of them
+ * is known to be referenced by nothing else.
+ */
+static void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	int i;
+
+	if (!n)
+		return;
+
+	spin_lock(&swap_lock);
+	for (i = 0; i < n; i++)
+		swap_entry_free(swap_info[swp_type(entries[i])], entries[i],
+				SWAP_HAS_CACHE);
+	spin_unlock(&swap_lock);
+}
+
+/*
+ * Give back everything cached by one cpu: the slots it had allocated
+ * but not handed out, and the slots waiting to be freed.
+ */
+static void drain_slots_cache_cpu(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	mutex_lock(&cache->alloc_lock);
+	swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+	cache->cur = 0;
+	cache->nr = 0;
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&cache->free_lock);
+	swapcache_free_entries(cache->slots_ret, cache->n_ret);
+	cache->n_ret = 0;
+	spin_unlock(&cache->free_lock);
+}
+
+static void drain_slots_cache(void)
+{
+	unsigned int cpu;
+
+	if (!swap_slot_cache_enabled)
+		return;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		drain_slots_cache_cpu(cpu);
+	put_online_cpus();
 }
 
+/*
+ * Called from swapcache_free() for an entry whose only reference is
+ * the swap cache.  Returns false if the entry has to be freed directly.
+ */
+static bool free_swap_slot(swp_entry_t entry, struct page *page)
+{
+	struct swap_slots_cache *cache;
+	struct swap_info_struct *p;
+	unsigned long offset = swp_offset(entry);
+	unsigned int type = swp_type(entry);
+	bool queued = false;
+
+	if (!swap_slot_cache_active())
+		return false;
+	if (type >= nr_swapfiles)
+		return false;
+	p = swap_info[type];
+
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	spin_lock(&cache->free_lock);
+	/*
+	 * The page has just left the swap cache, so nobody can take a new
+	 * reference to the entry: if the swap cache was its only user, it
+	 * stays that way until we free it.  Checking SWP_WRITEOK under
+	 * free_lock keeps us from queueing after swapoff's drain.
+	 */
+	if (!(p->flags & SWP_WRITEOK) || offset >= p->max ||
+	    p->swap_map[offset] != SWAP_HAS_CACHE)
+		goto out;
+
+	if (page)
+		mem_cgroup_uncharge_swapcache(page, entry, 0);
+	cache->slots_ret[cache->n_ret++] = entry;
+	if (cache->n_ret == SWAP_SLOTS_CACHE_SIZE) {
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+	}
+	queued = true;
+out:
+	spin_unlock(&cache->free_lock);
+	return queued;
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	entry.val = 0;
+	if (!swap_slot_cache_active()) {
+		/*
+		 * Near full: the last free slots may be sitting in other
+		 * cpus' caches, so give those back before failing.
+		 */
+		if (!get_swap_pages(1, &entry) && swap_slot_cache_enabled) {
+			drain_slots_cache();
+			get_swap_pages(1, &entry);
+		}
+		return entry;
+	}
+
+	cache = &per_cpu(swp_slots, raw_smp_processor_id());
+	mutex_lock(&cache->alloc_lock);
+	if (!cache->nr) {
+		cache->cur = 0;
+		cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+	}
+	if (cache->nr) {
+		entry = cache->slots[cache->cur++];
+		cache->nr--;
+	}
+	mutex_unlock(&cache->alloc_lock);
+	return entry;
+}
+
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nfb,
+					     unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((long)hcpu);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_cache_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	swap_slot_cache_enabled = true;
+	return 0;
+}
+__initcall(swap_slots_cache_init);
+
 /* The only caller of this function is now susupend routine */
 swp_entry_t get_swap_page_of_type(int type)
 {
@@ -589,6 +1074,8 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 			swap_list.next = p->type;
 		nr_swap_pages++;
 		p->inuse_pages--;
+		dec_cluster_info_page(p, offset);
+		zswap_invalidate_page(p->type, offset);
 		if ((p->flags & SWP_BLKDEV) &&
 				disk->fops->swap_slot_free_notify)
 			disk->fops->swap_slot_free_notify(p->bdev, offset);
@@ -620,6 +1107,9 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 	struct swap_info_struct *p;
 	unsigned char count;
 
+	if (free_swap_slot(entry, page))
+		return;
+
 	p = swap_info_get(entry);
 	if (p) {
 		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
@@ -1552,6 +2042,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct *p = NULL;
 	unsigned char *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster __percpu *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1614,6 +2106,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	/* no more slots of this area may hide in the per-cpu caches */
+	drain_slots_cache();
+
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
@@ -1645,6 +2140,9 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	down_write(&swap_unplug_sem);
 	up_write(&swap_unplug_sem);
 
+	flush_work(&p->discard_work);
+	zswap_invalidate_area(type);
+
 	destroy_swap_extents(p);
 	if (p->flags & SWP_CONTINUED)
 		free_swap_count_continuations(p);
@@ -1666,10 +2164,16 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1847,6 +2351,51 @@ late_initcall(max_swapfiles_check);
  *
  * The swapon system call
  */
+/*
+ * Set up the cluster allocator for a solid state swap area: count the
+ * slots already in use (header, bad pages, and the tail of the last
+ * cluster beyond the end of the area) and chain the empty clusters.
+ */
+static int setup_swap_clusters(struct swap_info_struct *p,
+			       unsigned char *swap_map)
+{
+	struct swap_cluster_info *cluster_info;
+	unsigned long nr_clusters, idx, i;
+	unsigned int cpu;
+
+	nr_clusters = DIV_ROUND_UP(p->max, SWAPFILE_CLUSTER);
+	cluster_info = vzalloc(nr_clusters * sizeof(*cluster_info));
+	if (!cluster_info)
+		return -ENOMEM;
+
+	p->percpu_cluster = alloc_percpu(struct percpu_cluster);
+	if (!p->percpu_cluster) {
+		vfree(cluster_info);
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu)
+		cluster_set_null(&per_cpu_ptr(p->percpu_cluster, cpu)->index);
+
+	for (i = 0; i < nr_clusters * SWAPFILE_CLUSTER; i++) {
+		if (i < p->max && !swap_map[i])
+			continue;
+		idx = i / SWAPFILE_CLUSTER;
+		cluster_set_count(&cluster_info[idx],
+				  cluster_count(&cluster_info[idx]) + 1);
+	}
+
+	p->cluster_info = cluster_info;
+	cluster_set_null(&p->free_cluster_head);
+	cluster_set_null(&p->free_cluster_tail);
+	cluster_set_null(&p->discard_cluster_head);
+	cluster_set_null(&p->discard_cluster_tail);
+	for (idx = 0; idx < nr_clusters; idx++) {
+		if (!cluster_count(&cluster_info[idx]))
+			free_cluster(p, idx);
+	}
+	return 0;
+}
+
 SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 {
 	struct swap_info_struct *p;
@@ -1864,6 +2413,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	unsigned long maxpages;
 	unsigned long swapfilepages;
 	unsigned char *swap_map = NULL;
+	struct zswap_tree *ztree = NULL;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
@@ -1905,6 +2455,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		 */
 	}
 	INIT_LIST_HEAD(&p->first_swap_extent.list);
+	INIT_WORK(&p->discard_work, swap_discard_work);
 	p->flags = SWP_USED;
 	p->next = -1;
 	spin_unlock(&swap_lock);
@@ -2095,6 +2646,15 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 			p->flags |= SWP_DISCARDABLE;
 	}
 
+	if (p->flags & SWP_SOLIDSTATE) {
+		error = setup_swap_clusters(p, swap_map);
+		if (error)
+			goto bad_swap;
+	}
+
+	/* zswap allocates with GFP_KERNEL, so do it before taking swap_lock */
+	ztree = zswap_alloc_area(type);
+
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	if (swap_flags & SWAP_FLAG_PREFER)
@@ -2103,6 +2663,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	else
 		p->prio = --least_priority;
 	p->swap_map = swap_map;
+	zswap_init_area(type, ztree);
 	p->flags |= SWP_WRITEOK;
 	nr_swap_pages += nr_good_pages;
 	total_swap_pages += nr_good_pages;
@@ -2141,11 +2702,16 @@ bad_swap:
 	destroy_swap_extents(p);
 	swap_cgroup_swapoff(type);
 bad_swap_2:
+	zswap_free_area(ztree);
 	spin_lock(&swap_lock);
 	p->swap_file = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(p->cluster_info);
+	p->cluster_info = NULL;
+	free_percpu(p->percpu_cluster);
+	p->percpu_cluster = NULL;
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -2316,10 +2882,16 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	if (end > si->max)	/* don't go beyond end of map */
 		end = si->max;
 
+	/*
+	 * Slots with no reference but the swap cache may be sitting in a
+	 * per-cpu slot cache without any page behind them: reading them in
+	 * would wait for a page that never comes.
+	 */
+
 	/* Count contiguous allocated slots above our target */
 	for (toff = target; ++toff < end; nr_pages++) {
 		/* Don't read in free or bad pages */
-		if (!si->swap_map[toff])
+		if (!swap_count(si->swap_map[toff]))
 			break;
 		if (swap_count(si->swap_map[toff]) == SWAP_MAP_BAD)
 			break;
@@ -2327,7 +2899,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	/* Count contiguous allocated slots below our target */
 	for (toff = target; --toff >= base; nr_pages++) {
 		/* Don't read in free or bad pages */
-		if (!si->swap_map[toff])
+		if (!swap_count(si->swap_map[toff]))
 			break;
 		if (swap_count(si->swap_map[toff]) == SWAP_MAP_BAD)
 			break;
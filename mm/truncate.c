@@ -182,6 +182,50 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Reclaim leaves shadow entries behind in the page cache to detect
+ * refaults, see mm/workingset.c.  Drop the ones in [start, end].
+ */
+static void truncate_shadow_entries(struct address_space *mapping,
+				    pgoff_t start, pgoff_t end)
+{
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	pgoff_t index = start;
+
+	while (mapping->nrshadows) {
+		unsigned int nr, i, nr_shadows = 0;
+		pgoff_t last = index;
+		bool done;
+
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, index, PAGEVEC_SIZE);
+		for (i = 0; i < nr; i++) {
+			void *entry;
+
+			if (indices[i] > end)
+				break;
+			last = indices[i];
+			entry = radix_tree_deref_slot_protected(slots[i],
+							&mapping->tree_lock);
+			if (radix_tree_exceptional_entry(entry))
+				indices[nr_shadows++] = last;
+		}
+		done = i < nr || nr < PAGEVEC_SIZE || last == end;
+		/* Delete only after the walk, the slots point into nodes */
+		for (i = 0; i < nr_shadows; i++)
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+		mapping->nrshadows -= nr_shadows;
+		spin_unlock_irq(&mapping->tree_lock);
+
+		if (done)
+			break;
+		index = last + 1;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -212,10 +256,17 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t end;
 	const unsigned partial = lstart & (PAGE_CACHE_SIZE - 1);
 	struct pagevec pvec;
+	unsigned long nrpages;
 	pgoff_t next;
 	int i;
 
-	if (mapping->nrpages == 0)
+	/*
+	 * Reclaim replaces pages with shadow entries, bumping nrshadows
+	 * before dropping nrpages, see page_cache_tree_delete().
+	 */
+	nrpages = mapping->nrpages;
+	smp_rmb();
+	if (nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -290,6 +341,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		pagevec_release(&pvec);
 		mem_cgroup_uncharge_end();
 	}
+	truncate_shadow_entries(mapping, start, end);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
 
@@ -387,7 +439,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
@@ -490,6 +542,7 @@ int invalidate_inode_pages2_range(struct address_space *mapping,
 		mem_cgroup_uncharge_end();
 		cond_resched();
 	}
+	truncate_shadow_entries(mapping, start, end);
 	return ret;
 }
 EXPORT_SYMBOL_GPL(invalidate_inode_pages2_range);
@@ -750,6 +750,8 @@ static const char * const vmstat_text[] = {
 	"nr_shmem",
 	"nr_dirtied",
 	"nr_written",
+	"workingset_refault",
+	"workingset_activate",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -773,6 +775,10 @@ static const char * const vmstat_text[] = {
 	"pgfree",
 	"pgactivate",
 	"pgdeactivate",
+	"pgalloc_pcp_hit",
+	"pgalloc_pcp_refill",
+	"pgalloc_pcp_high_order_hit",
+	"pgalloc_pcp_high_order_refill",
 
 	"pgfault",
 	"pgmajfault",
@@ -796,6 +802,18 @@ static const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"lru_lock_contended",
+#ifdef CONFIG_LRU_LOCK_STATS
+	"lru_lock_hold_ns",
+#endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
+	"numa_task_migrations",
+#endif
 
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",